@@ -0,0 +1,326 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Benchmarks for tokenize and its passes, printed as JSON.
+//
+// Usage: bench [--min-time=SECONDS] [--filter=TEXT]
+//
+// Each case is run for each phase:
+//   tokenize        the whole of tokenize
+//   scan            _scan_tokens only
+//   fix_whitespace  _fix_whitespace_tokens on the raw tokens
+//   infer           _infer_token_subtypes on the fixed tokens
+//
+// The fix_whitespace and infer phases include copying their input tokens into a
+// reused vector, as both passes modify the tokens in place.
+//
+// The generated case tokenizes a batch of synthetic formulas from FormulaGenerator
+// with tokenize_batch, as a workload closer to a real spreadsheet.
+
+#include "xlfparser.h"
+#include "xlfparser_generator.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <stack>
+#include <string>
+#include <vector>
+
+using namespace xlfparser;
+
+
+// Count heap allocations by replacing the global operator new
+static std::atomic<size_t> g_allocations{0};
+static std::atomic<size_t> g_allocated_bytes{0};
+
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+// The other forms forward to these two, as do the standard library's nothrow forms. The
+// free is kept out of line, or GCC warns that it frees memory from operator new once it's
+// inlined into a caller.
+#if defined(__GNUC__)
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+void* operator new[](std::size_t size) { return operator new(size); }
+BENCH_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, std::size_t) noexcept { operator delete(p); }
+
+
+// Stops the compiler optimizing away the benchmarked calls
+static volatile size_t g_sink = 0;
+
+
+struct Case
+{
+    std::string name;
+    std::string formula;
+};
+
+
+static std::string repeat(const std::string& str, size_t count, const std::string& separator = "")
+{
+    std::string result;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i > 0)
+            result += separator;
+        result += str;
+    }
+    return result;
+}
+
+
+static std::vector<Case> make_cases()
+{
+    std::vector<Case> cases;
+
+    cases.push_back({"short", "=SUM(A1:B2)+1"});
+    cases.push_back({"typical", "=IF(VLOOKUP($A2,Sheet2!$A$1:$D$100,3,FALSE)>0,B2*1.5E+3%,\"n/a\")"});
+    cases.push_back({"deep_nesting", "=" + repeat("SUM(1,", 200) + "1" + repeat(")", 200)});
+    cases.push_back({"long_string", "=\"" + repeat("abc \"\"quoted\"\" text ", 500) + "\""});
+    cases.push_back({"huge_array", "={" + repeat(repeat("1.5", 20, ","), 500, ";") + "}"});
+    cases.push_back({"r1c1", "=" + repeat("R[-1]C[2]*RC1+R1C[-3]", 100, "+")});
+    cases.push_back({"whitespace", "=" + repeat("( A1:A10  B5:C6 )", 100, " + ")});
+
+    // Pathological inputs, which should still be linear in their length
+    cases.push_back({"long_number", "=" + repeat("1", 5000)});
+    cases.push_back({"long_error", "=#" + repeat("A", 5000)});
+    cases.push_back({"deep_parens", "=" + repeat("(", 5000) + "1" + repeat(")", 5000)});
+
+    return cases;
+}
+
+
+struct Result
+{
+    size_t iterations;
+    double seconds;
+    size_t allocations;
+    size_t allocated_bytes;
+};
+
+
+// Run fn repeatedly until it's taken at least min_time seconds
+static Result run(const std::function<void()>& fn, double min_time)
+{
+    fn();  // warm up
+
+    size_t iterations = 1;
+    while (true)
+    {
+        const size_t allocations = g_allocations.load();
+        const size_t allocated_bytes = g_allocated_bytes.load();
+        const auto start = std::chrono::steady_clock::now();
+
+        for (size_t i = 0; i < iterations; ++i)
+            fn();
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() >= min_time || iterations >= (size_t(1) << 30))
+            return {iterations, elapsed.count(), g_allocations.load() - allocations, g_allocated_bytes.load() - allocated_bytes};
+
+        iterations *= 2;
+    }
+}
+
+
+static void report(const std::string& full_name,
+                   const std::string& name,
+                   const char* char_name,
+                   const char* phase,
+                   size_t chars,
+                   size_t tokens,
+                   const Result& result,
+                   std::ostream& out,
+                   bool& first)
+{
+    const double calls = double(result.iterations);
+
+    out << (first ? "\n" : ",\n")
+        << "    {\"name\": \"" << full_name << "\""
+        << ", \"case\": \"" << name << "\""
+        << ", \"char\": \"" << char_name << "\""
+        << ", \"phase\": \"" << phase << "\""
+        << ", \"chars\": " << chars
+        << ", \"tokens\": " << tokens
+        << ", \"iterations\": " << result.iterations
+        << ", \"ns_per_call\": " << result.seconds * 1e9 / calls
+        << ", \"ns_per_char\": " << result.seconds * 1e9 / (calls * chars)
+        << ", \"tokens_per_sec\": " << calls * tokens / result.seconds
+        << ", \"allocs_per_call\": " << result.allocations / calls
+        << ", \"bytes_per_call\": " << result.allocated_bytes / calls
+        << "}";
+
+    first = false;
+}
+
+
+template <typename char_type>
+static void bench_case(const std::string& name,
+                       const std::basic_string<char_type>& formula,
+                       const char* char_name,
+                       double min_time,
+                       const std::string& filter,
+                       std::ostream& out,
+                       bool& first)
+{
+    const Options<char_type> options;
+    const size_t num_tokens = tokenize(formula, options).size();
+
+    // Inputs for the individual passes
+    std::vector<Token> raw;
+    std::stack<Token::Type> stack;
+    _scan_tokens(formula.data(), formula.size(), options, 1, stack, raw,
+                 [](size_t, const std::stack<Token::Type>&) { return false; });
+
+    std::vector<Token> fixed = raw;
+    _fix_whitespace_tokens(fixed, 0);
+
+    std::vector<Token> work;
+    work.reserve(raw.size());
+
+    std::vector<std::pair<const char*, std::function<void()>>> phases = {
+        {"tokenize", [&]() {
+            g_sink = g_sink + tokenize(formula, options).size();
+        }},
+        {"scan", [&]() {
+            work.clear();
+            std::stack<Token::Type> scan_stack;
+            _scan_tokens(formula.data(), formula.size(), options, 1, scan_stack, work,
+                         [](size_t, const std::stack<Token::Type>&) { return false; });
+            g_sink = g_sink + work.size();
+        }},
+        {"fix_whitespace", [&]() {
+            work.assign(raw.begin(), raw.end());
+            _fix_whitespace_tokens(work, 0);
+            g_sink = g_sink + work.size();
+        }},
+        {"infer", [&]() {
+            work.assign(fixed.begin(), fixed.end());
+            _infer_token_subtypes(work.begin(), work.end(), options, formula.data(), formula.size());
+            g_sink = g_sink + work.size();
+        }}
+    };
+
+    for (const auto& phase : phases)
+    {
+        const std::string full_name = name + "/" + char_name + "/" + phase.first;
+        if (!filter.empty() && full_name.find(filter) == std::string::npos)
+            continue;
+
+        const Result result = run(phase.second, min_time);
+        report(full_name, name, char_name, phase.first, formula.size(), num_tokens, result, out, first);
+    }
+}
+
+
+// Tokenize a batch of generated formulas
+template <typename char_type>
+static void bench_generated(const std::vector<std::string>& generated,
+                            const char* char_name,
+                            double min_time,
+                            const std::string& filter,
+                            std::ostream& out,
+                            bool& first)
+{
+    const std::string full_name = std::string("generated/") + char_name + "/batch";
+    if (!filter.empty() && full_name.find(filter) == std::string::npos)
+        return;
+
+    std::vector<std::basic_string<char_type>> formulas;
+    size_t chars = 0;
+    for (const auto& formula : generated)
+    {
+        formulas.emplace_back(formula.begin(), formula.end());
+        chars += formula.size();
+    }
+
+    const size_t num_tokens = tokenize_batch(formulas).tokens.size();
+    const Result result = run([&]() {
+        g_sink = g_sink + tokenize_batch(formulas).tokens.size();
+    }, min_time);
+
+    report(full_name, "generated", char_name, "batch", chars, num_tokens, result, out, first);
+}
+
+
+int main(int argc, char** argv)
+{
+    double min_time = 0.2;
+    std::string filter;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg.rfind("--min-time=", 0) == 0)
+            min_time = std::atof(arg.c_str() + 11);
+        else if (arg.rfind("--filter=", 0) == 0)
+            filter = arg.substr(9);
+        else
+        {
+            std::cerr << "Usage: bench [--min-time=SECONDS] [--filter=TEXT]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::ostringstream out;
+    out << "{\n  \"benchmarks\": [";
+
+    bool first = true;
+    for (const auto& c : make_cases())
+    {
+        bench_case(c.name, c.formula, "char", min_time, filter, out, first);
+        bench_case(c.name, std::wstring(c.formula.begin(), c.formula.end()), "wchar_t", min_time, filter, out, first);
+    }
+
+    const FormulaGenerator generator;
+    std::vector<std::string> generated;
+    for (uint64_t i = 0; i < 1000; ++i)
+        generated.push_back(generator(i));
+
+    bench_generated<char>(generated, "char", min_time, filter, out, first);
+    bench_generated<wchar_t>(generated, "wchar_t", min_time, filter, out, first);
+
+    out << "\n  ]\n}\n";
+    std::cout << out.str() << std::flush;
+
+    return 0;
+}
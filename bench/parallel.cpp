@@ -0,0 +1,127 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Measures how tokenize_batch scales with the number of threads.
+//
+// Usage: bench_parallel [formulas] [max_threads]
+
+#include <xlfparser.h>
+#include <xlfparser_parallel.h>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace xlfparser;
+
+
+// Formulas of very different lengths, so the work per formula is uneven
+static std::vector<std::string> make_formulas(size_t count)
+{
+    const char* parts[] = {
+        "SUM(A1:B10)",
+        "IF(A1>0,\"yes\",\"no\")",
+        "VLOOKUP($A2,Sheet2!$A$1:$D$100,3,FALSE)",
+        "{1,2;3,4}",
+        "1.5E+3*B2%",
+        "INDEX(Table1[Amount],MATCH(C3,Table1[Key],0))"
+    };
+    const size_t num_parts = sizeof(parts) / sizeof(parts[0]);
+
+    std::vector<std::string> formulas;
+    formulas.reserve(count);
+
+    unsigned long long state = 12345;
+    for (size_t i = 0; i < count; ++i)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        const unsigned r = unsigned(state >> 33);
+
+        // Mostly short formulas with the occasional very long one
+        const size_t terms = (r % 100 == 0) ? 200 + r % 300 : 1 + r % 4;
+
+        std::string formula = "=";
+        for (size_t j = 0; j < terms; ++j)
+        {
+            if (j > 0)
+                formula += "+";
+            formula += parts[(r + j) % num_parts];
+        }
+        formulas.push_back(std::move(formula));
+    }
+
+    return formulas;
+}
+
+
+int main(int argc, char** argv)
+{
+    const size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+    size_t max_threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : std::thread::hardware_concurrency();
+    if (max_threads == 0)
+        max_threads = 1;
+
+    const auto formulas = make_formulas(count);
+    std::vector<std::string_view> views(formulas.begin(), formulas.end());
+
+    size_t chars = 0;
+    for (const auto& formula : formulas)
+        chars += formula.size();
+
+    std::cout << "formulas: " << count << ", characters: " << chars << std::endl;
+    std::cout << std::setw(8) << "threads"
+              << std::setw(12) << "seconds"
+              << std::setw(16) << "formulas/s"
+              << std::setw(12) << "MB/s"
+              << std::setw(10) << "speedup" << std::endl;
+
+    double baseline = 0;
+    for (size_t threads = 1; threads <= max_threads; ++threads)
+    {
+        ThreadPool pool(threads);
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto batch = tokenize_batch(pool, views.data(), views.size());
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        const double seconds = elapsed.count();
+        if (threads == 1)
+            baseline = seconds;
+
+        std::cout << std::setw(8) << threads
+                  << std::setw(12) << std::fixed << std::setprecision(3) << seconds
+                  << std::setw(16) << std::setprecision(0) << count / seconds
+                  << std::setw(12) << std::setprecision(1) << chars / seconds / 1e6
+                  << std::setw(10) << std::setprecision(2) << baseline / seconds
+                  << std::endl;
+
+        if (batch.size() != count)
+            return 1;
+    }
+
+    return 0;
+}
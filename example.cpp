@@ -111,6 +111,12 @@ std::ostream& operator<<(std::ostream& os, Token::Subtype t)
         case Token::Subtype::Union:
             os << "Union";
             break;
+        case Token::Subtype::Name:
+            os << "Name";
+            break;
+        case Token::Subtype::Spill:
+            os << "Spill";
+            break;
         default:
             os << "Unknown";
             break;
@@ -0,0 +1,533 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Differential fuzz target. Every way of tokenizing a formula must give the same tokens
+// as tokenize, or fail in the same way, for any input:
+//
+//   reference the tokenizer from before it was rewritten, see reference_xlfparser.h
+//   wide      tokenize with wchar_t
+//   batch     tokenize_batch
+//   parallel  tokenize_batch with a ThreadPool
+//   cache     TokenCache, on a miss and on a hit
+//   edit      retokenize after an edit
+//   sheet     for_each_sheet_formula on the formula in worksheet XML
+//   file      write_token_file and TokenFile
+//
+// The first byte of the input selects the options (see make_options), and the rest is one
+// or more formulas separated by newlines. Each formula is tokenized from a heap buffer of
+// exactly its size, so reads past the end are caught by AddressSanitizer. Mismatches abort
+// with a description of the formula, so libFuzzer or AFL reports them as crashes.
+
+#include "xlfparser.h"
+#include "xlfparser_cache.h"
+#include "xlfparser_parallel.h"
+#include "xlfparser_sheetxml.h"
+#include "xlfparser_tokenfile.h"
+#include "reference_xlfparser.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define XLFP_GETPID _getpid
+#else
+#include <unistd.h>
+#define XLFP_GETPID getpid
+#endif
+
+using namespace xlfparser;
+
+
+namespace {
+
+    // A copy of a string in a heap buffer of exactly its size, with no '\0' after it
+    template <typename char_type>
+    std::unique_ptr<char_type[]> exact_copy(std::basic_string_view<char_type> str)
+    {
+        std::unique_ptr<char_type[]> buffer(new char_type[str.size()]);
+        std::copy(str.begin(), str.end(), buffer.get());
+        return buffer;
+    }
+
+    // The formulas from an input, each in its own exact size buffer
+    class Formulas
+    {
+    public:
+        void add(std::string_view formula)
+        {
+            m_buffers.push_back(exact_copy(formula));
+            m_views.emplace_back(m_buffers.back().get(), formula.size());
+        }
+
+        size_t size() const { return m_views.size(); }
+        std::string_view operator[](size_t i) const { return m_views[i]; }
+        const std::vector<std::string_view>& views() const { return m_views; }
+
+    private:
+        std::vector<std::unique_ptr<char[]>> m_buffers;
+        std::vector<std::string_view> m_views;
+    };
+
+    // The tokens for a formula, or no tokens and ok = false if it's invalid
+    struct Result
+    {
+        bool ok;
+        std::vector<Token> tokens;
+
+        bool operator==(const Result& other) const
+        {
+            return ok == other.ok && tokens == other.tokens;
+        }
+    };
+
+    template <typename fn_type>
+    Result run(fn_type&& fn)
+    {
+        // Only invalid_formula is expected, anything else escapes and is reported as a crash
+        try
+        {
+            return {true, fn()};
+        }
+        catch (const invalid_formula&)
+        {
+            return {false, {}};
+        }
+    }
+
+    Result from_batch(const TokenBatch& batch, size_t i)
+    {
+        return {batch.status[i] == TokenBatch::Status::Ok, std::vector<Token>(batch[i].begin(), batch[i].end())};
+    }
+
+    void check(const Result& expected, const Result& actual, const char* path, std::string_view formula)
+    {
+        if (expected == actual)
+            return;
+
+        std::fprintf(stderr, "%s: result differs from tokenize (%s with %zu tokens, expected %s with %zu tokens)\n",
+                     path,
+                     actual.ok ? "ok" : "invalid", actual.tokens.size(),
+                     expected.ok ? "ok" : "invalid", expected.tokens.size());
+        std::fprintf(stderr, "formula (%zu chars): ", formula.size());
+        std::fwrite(formula.data(), 1, formula.size(), stderr);
+        std::fprintf(stderr, "\n");
+        std::abort();
+    }
+
+    // Bits 0-2 of the first byte of the input, so '0' selects the defaults:
+    //   1  formulas don't start with '='
+    //   2  separators used in many European locales
+    //   4  parentheses for R1C1 brackets, as used in some locales
+    Options<char> make_options(uint8_t flags)
+    {
+        Options<char> options;
+        options.leading_equals = (flags & 1) == 0;
+
+        if (flags & 2)
+        {
+            options.list_separator = ';';
+            options.decimal_separator = ',';
+            options.row_separator = '\\';
+        }
+
+        if (flags & 4)
+        {
+            options.left_bracket = '(';
+            options.right_bracket = ')';
+        }
+
+        return options;
+    }
+
+    Options<wchar_t> widen(const Options<char>& options)
+    {
+        auto widen_char = [](const std::optional<char>& c) -> std::optional<wchar_t> {
+            if (c)
+                return wchar_t(static_cast<unsigned char>(*c));
+            return std::nullopt;
+        };
+
+        Options<wchar_t> result;
+        result.left_brace = widen_char(options.left_brace);
+        result.right_brace = widen_char(options.right_brace);
+        result.left_bracket = widen_char(options.left_bracket);
+        result.right_bracket = widen_char(options.right_bracket);
+        result.list_separator = widen_char(options.list_separator);
+        result.decimal_separator = widen_char(options.decimal_separator);
+        result.row_separator = widen_char(options.row_separator);
+        result.leading_equals = options.leading_equals;
+        return result;
+    }
+
+    uint64_t fnv1a(std::string_view str)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (char c : str)
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        return hash;
+    }
+
+    // Well short of the tokens the reference's regular expressions overflow the stack on
+    const size_t MAX_REFERENCE_SIZE = 4096;
+
+    // Whether a # after formula[i] would start an error in both tokenizers, because
+    // formula[i] always ends the token before it
+    bool ends_token(std::string_view formula, size_t i, const Options<char>& options)
+    {
+        const char c = formula[i];
+        if (c == '+' || c == '-')
+        {
+            // unless it's part of a number, eg. 1E+
+            return i == 0 || (formula[i - 1] != 'E' && formula[i - 1] != 'e');
+        }
+
+        return std::strchr(" */^&=<>@%(){}!\"", c) != nullptr || c == options.list_separator.value_or(',');
+    }
+
+    // Whether the reference should give the same tokens as tokenize. Formulas that might use
+    // anything tokenize deliberately handles differently now are skipped:
+    //   brackets set in the options, which the reference closed with the right brace
+    //   nested brackets or ' in brackets, eg. Table1[[#This Row],['#Items]]
+    //   # after a reference, eg. A1#, which is now the spill operator rather than an error
+    // as are formulas the reference could crash on:
+    //   invalid formulas with a right brace, as it popped two tokens after checking for one
+    //   long formulas, as its regular expressions recurse for each character of a token
+    bool reference_applies(std::string_view formula, const Result& expected, const Options<char>& options)
+    {
+        if (options.left_bracket || options.right_bracket)
+            return false;
+
+        if (!expected.ok && formula.find(options.right_brace.value_or('}')) != std::string_view::npos)
+            return false;
+
+        if (formula.size() > MAX_REFERENCE_SIZE)
+            return false;
+
+        bool in_string = false;
+        bool in_path = false;
+        bool in_brackets = false;
+        for (size_t i = 0; i < formula.size(); ++i)
+        {
+            const char c = formula[i];
+            if (in_string)
+                in_string = c != '"';
+            else if (in_path)
+                in_path = c != '\'';
+            else if (in_brackets)
+            {
+                if (c == '[' || c == '\'')
+                    return false;
+                in_brackets = c != ']';
+            }
+            else if (c == '#' && i > 0 && !ends_token(formula, i - 1, options))
+                return false;
+            else
+            {
+                in_string = c == '"';
+                in_path = c == '\'';
+                in_brackets = c == '[';
+            }
+        }
+
+        return true;
+    }
+
+    // Operands the reference gave the Range subtype to now have more specific subtypes
+    Result with_reference_subtypes(Result result)
+    {
+        for (auto& token : result.tokens)
+        {
+            if (token.type() == Token::Type::Operand && (token.subtype() == Token::Subtype::Name
+                                                         || token.subtype() == Token::Subtype::Spill
+                                                         || token.subtype() == Token::Subtype::Logical))
+                token = Token(token.start(), token.end(), token.type(), Token::Subtype::Range);
+        }
+
+        return result;
+    }
+
+    Result run_reference(std::string_view formula, const Options<char>& options)
+    {
+        // The reference always skips a leading '=', and reads the '\0' after the formula
+        const std::string equals = options.leading_equals ? "" : "=";
+        const std::string copy = equals + std::string(formula);
+
+        xlfparser_reference::Options<char> reference_options;
+        reference_options.left_brace = options.left_brace;
+        reference_options.right_brace = options.right_brace;
+        reference_options.left_bracket = options.left_bracket;
+        reference_options.right_bracket = options.right_bracket;
+        reference_options.list_separator = options.list_separator;
+        reference_options.decimal_separator = options.decimal_separator;
+        reference_options.row_separator = options.row_separator;
+
+        std::vector<xlfparser_reference::Token> tokens;
+        try
+        {
+            tokens = xlfparser_reference::tokenize(copy, reference_options);
+        }
+        catch (const std::exception&)
+        {
+            // it also threw std::out_of_range for some invalid formulas
+            return {false, {}};
+        }
+
+        Result result{true, {}};
+        for (const auto& token : tokens)
+        {
+            result.tokens.emplace_back(token.start() - equals.size(),
+                                       token.end() - equals.size(),
+                                       Token::Type(int(token.type())),
+                                       Token::Subtype(int(token.subtype())));
+        }
+
+        return result;
+    }
+
+    void check_reference(const Formulas& formulas,
+                         const std::vector<Result>& expected,
+                         const Options<char>& options)
+    {
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            if (reference_applies(formulas[i], expected[i], options))
+                check(with_reference_subtypes(expected[i]), run_reference(formulas[i], options), "reference", formulas[i]);
+        }
+    }
+
+    void check_wide(const Formulas& formulas,
+                    const std::vector<Result>& expected,
+                    const Options<char>& options)
+    {
+        const Options<wchar_t> wide_options = widen(options);
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            std::wstring wide;
+            for (char c : formulas[i])
+                wide.push_back(wchar_t(static_cast<unsigned char>(c)));
+
+            const auto buffer = exact_copy(std::wstring_view(wide));
+            check(expected[i], run([&]() { return tokenize(buffer.get(), wide.size(), wide_options); }), "wide", formulas[i]);
+        }
+    }
+
+    void check_batches(const Formulas& formulas,
+                       const std::vector<Result>& expected,
+                       const Options<char>& options)
+    {
+        static ThreadPool pool(3);
+
+        const TokenBatch batch = tokenize_batch(formulas.views(), options);
+        const TokenBatch parallel = tokenize_batch(pool, formulas.views(), options);
+
+        if (batch.size() != formulas.size() || parallel.size() != formulas.size())
+        {
+            std::fprintf(stderr, "batch: wrong number of formulas\n");
+            std::abort();
+        }
+
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            check(expected[i], from_batch(batch, i), "batch", formulas[i]);
+            check(expected[i], from_batch(parallel, i), "parallel", formulas[i]);
+        }
+    }
+
+    void check_cache(const Formulas& formulas,
+                     const std::vector<Result>& expected,
+                     const Options<char>& options)
+    {
+        // Shared between inputs, so cached tokens from other formulas and options can be returned wrongly
+        static TokenCache<char> cache(1 << 20, 4);
+
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            auto tokenize_cached = [&]() { return *cache.tokenize(formulas[i], options); };
+            check(expected[i], run(tokenize_cached), "cache miss", formulas[i]);
+            check(expected[i], run(tokenize_cached), "cache hit", formulas[i]);
+        }
+    }
+
+    void check_edits(const Formulas& formulas,
+                     const std::vector<Result>& expected,
+                     const Options<char>& options)
+    {
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            // Make up a formula that the input formula could have been edited from, by replacing
+            // some of it with a copy of some other part of it.
+            const std::string_view formula = formulas[i];
+            const uint64_t hash = fnv1a(formula);
+
+            const size_t offset = size_t(hash % (formula.size() + 1));
+            const size_t inserted = size_t((hash >> 16) % 8) % (formula.size() - offset + 1);
+            const size_t source = size_t((hash >> 24) % (formula.size() + 1));
+            const size_t removed = std::min(size_t((hash >> 32) % 8), formula.size() - source);
+
+            Formulas before;
+            before.add(std::string(formula.substr(0, offset))
+                       + std::string(formula.substr(source, removed))
+                       + std::string(formula.substr(offset + inserted)));
+
+            const Result previous = run([&]() { return tokenize(before[0], options); });
+            if (!previous.ok)
+                continue;
+
+            check(expected[i],
+                  run([&]() { return retokenize(previous.tokens, formula, offset, removed, inserted, options); }),
+                  "retokenize",
+                  formula);
+        }
+    }
+
+    void check_sheet_xml(const Formulas& formulas,
+                         const std::vector<Result>& expected,
+                         const Options<char>& options)
+    {
+        // Formulas are stored in the XML without the '='
+        const size_t body = options.leading_equals ? 1 : 0;
+
+        std::string xml = "<worksheet><sheetData>";
+        std::vector<size_t> indexes;
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            // Empty <f> elements aren't formulas
+            const std::string_view formula = formulas[i];
+            if (formula.size() <= body || (body > 0 && formula[0] != '='))
+                continue;
+
+            const std::string row = std::to_string(indexes.size() + 1);
+            xml += "<row r=\"" + row + "\"><c r=\"A" + row + "\"><f>";
+            for (size_t j = body; j < formula.size(); ++j)
+            {
+                switch (formula[j])
+                {
+                    case '&': xml += "&amp;"; break;
+                    case '<': xml += "&lt;"; break;
+                    case '>': xml += "&gt;"; break;
+                    case '"': xml += "&#34;"; break;
+                    default: xml.push_back(formula[j]);
+                }
+            }
+            xml += "</f></c></row>";
+            indexes.push_back(i);
+        }
+        xml += "</sheetData></worksheet>";
+
+        const auto buffer = exact_copy(std::string_view(xml));
+
+        size_t found = 0;
+        for_each_sheet_formula(buffer.get(), xml.size(), [&](const SheetFormula& f) {
+            if (found >= indexes.size())
+            {
+                std::fprintf(stderr, "sheet: too many formulas found\n");
+                std::abort();
+            }
+
+            // The token positions are relative to the formula without the '='
+            Result actual{f.status == TokenBatch::Status::Ok, std::vector<Token>(f.tokens.begin(), f.tokens.end())};
+            for (auto& token : actual.tokens)
+            {
+                token.start(token.start() + body);
+                token.end(token.end() + body);
+            }
+
+            const size_t i = indexes[found++];
+            check(expected[i], actual, "sheet", formulas[i]);
+        }, options);
+
+        if (found != indexes.size())
+        {
+            std::fprintf(stderr, "sheet: found %zu formulas, expected %zu\n", found, indexes.size());
+            std::abort();
+        }
+    }
+
+    void check_token_file(const Formulas& formulas,
+                          const std::vector<Result>& expected,
+                          const Options<char>& options)
+    {
+        static const std::string path = (std::filesystem::temp_directory_path() /
+            ("xlfparser_fuzz_" + std::to_string(XLFP_GETPID()) + ".bin")).string();
+
+        write_token_file(path, tokenize_batch(formulas.views(), options), formulas.views());
+
+        std::vector<Result> actual;
+        {
+            const TokenFile file(path);
+            for (size_t i = 0; i < formulas.size(); ++i)
+                actual.push_back({file.status(i) == TokenBatch::Status::Ok, file.tokens(i)});
+        }
+
+        // The file is removed before checking, as a mismatch aborts
+        std::remove(path.c_str());
+
+        for (size_t i = 0; i < formulas.size(); ++i)
+            check(expected[i], actual[i], "token file", formulas[i]);
+    }
+}
+
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    const Options<char> options = make_options(data[0]);
+    const std::string_view input(reinterpret_cast<const char*>(data + 1), size - 1);
+
+    Formulas formulas;
+    for (size_t start = 0; start <= input.size();)
+    {
+        size_t end = input.find('\n', start);
+        if (end == std::string_view::npos)
+            end = input.size();
+
+        formulas.add(input.substr(start, end - start));
+        start = end + 1;
+    }
+
+    std::vector<Result> expected;
+    for (size_t i = 0; i < formulas.size(); ++i)
+        expected.push_back(run([&]() { return tokenize(formulas[i], options); }));
+
+    check_reference(formulas, expected, options);
+    check_wide(formulas, expected, options);
+    check_batches(formulas, expected, options);
+    check_cache(formulas, expected, options);
+    check_edits(formulas, expected, options);
+    check_sheet_xml(formulas, expected, options);
+    check_token_file(formulas, expected, options);
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+"""
+Build the seed corpus for the fuzz target from the formulas in the tests and example.
+
+Every string literal starting with '=' in tests/tests.cpp and example.cpp is written to
+fuzz/corpus as an input using the default options, ie. prefixed with '0'. Run from anywhere:
+
+    python fuzz/make_corpus.py
+"""
+import hashlib
+import os
+import re
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SOURCES = [os.path.join(ROOT, "tests", "tests.cpp"), os.path.join(ROOT, "example.cpp")]
+CORPUS = os.path.join(ROOT, "fuzz", "corpus")
+
+LITERAL = re.compile(r'L?"((?:[^"\\\n]|\\.)*)"')
+ESCAPES = {"n": "\n", "t": "\t", "r": "\r", "0": "\0", "\\": "\\", '"': '"', "'": "'"}
+
+
+def unescape(literal):
+    def replace(match):
+        escape = match.group(1)
+        if len(escape) > 1:
+            return chr(int(escape[1:], 16))
+        return ESCAPES.get(escape, escape)
+
+    return re.sub(r"\\(u[0-9a-fA-F]{4}|U[0-9a-fA-F]{8}|.)", replace, literal)
+
+
+def main():
+    formulas = set()
+    for source in SOURCES:
+        with open(source, encoding="utf-8") as f:
+            for match in LITERAL.finditer(f.read()):
+                formula = unescape(match.group(1))
+                if formula.startswith("="):
+                    formulas.add(formula)
+
+    os.makedirs(CORPUS, exist_ok=True)
+    for formula in sorted(formulas):
+        data = b"0" + formula.encode("utf-8")
+        name = hashlib.sha1(data).hexdigest()[:16]
+        with open(os.path.join(CORPUS, name), "wb") as f:
+            f.write(data)
+
+    print("Wrote %d inputs to %s" % (len(formulas), CORPUS))
+
+
+if __name__ == "__main__":
+    main()
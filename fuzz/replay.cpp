@@ -0,0 +1,104 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Driver for the fuzz target without libFuzzer, for running the seed corpus or
+// reproducing a crash with any compiler, and for fuzzing with AFL.
+//
+// Usage: fuzz_replay [file or directory ...]
+//
+// Each file is passed to the fuzz target as one input. With no arguments a
+// single input is read from stdin, as AFL expects.
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+
+static void run(std::istream& in)
+{
+    const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+
+static bool run_file(const std::filesystem::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "fuzz_replay: unable to open " << path.string() << std::endl;
+        return false;
+    }
+
+    run(in);
+    return true;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        run(std::cin);
+        return 0;
+    }
+
+    size_t count = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::filesystem::path path(argv[i]);
+        if (std::filesystem::is_directory(path))
+        {
+            // Sorted so runs are reproducible
+            std::vector<std::filesystem::path> files;
+            for (const auto& entry : std::filesystem::directory_iterator(path))
+                if (entry.is_regular_file())
+                    files.push_back(entry.path());
+            std::sort(files.begin(), files.end());
+
+            for (const auto& file : files)
+            {
+                if (!run_file(file))
+                    return 1;
+                ++count;
+            }
+        }
+        else
+        {
+            if (!run_file(path))
+                return 1;
+            ++count;
+        }
+    }
+
+    std::cout << "fuzz_replay: ran " << count << " inputs" << std::endl;
+    return 0;
+}
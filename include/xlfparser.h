@@ -24,61 +24,72 @@ THE SOFTWARE.
 #ifndef _XLFPARSER_H_
 #define _XLFPARSER_H_
 
+#include <algorithm>
 #include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <stack>
 #include <tuple>
-#include <regex>
+#include <utility>
 #include <stdexcept>
 #include <optional>
 #include <sstream>
 
+#ifdef XLFP_STATS
+#include <atomic>
+#include <mutex>
+#endif
+
 
 namespace xlfparser {
 
     /*
-     * Helpers for setting constant string and char literals
-     * for char and wchar_t specializations of tokenize.
+     * Helper for setting constant char literals for the char types tokenize can be used
+     * with. Besides char and wchar_t, char16_t and char32_t can be used, as can uint8_t,
+     * uint16_t or uint32_t holding the 1, 2 or 4 byte storage of a Python str, in which
+     * case only ASCII literals are supported. std::char_traits isn't standard for the
+     * integer types, so they can only be passed as a pointer and size, not as strings.
      */
-    #define XLFP_STRING(x) _choose_string<char_type>(x, L##x)
     #define XLFP_CHAR(x) _choose_char<char_type>(x, L##x)
 
-    template <typename char_type>
-    constexpr const char_type* _choose_string(const char* c, const wchar_t* w)
-    {
-        static_assert(std::is_same<char_type, char>::value || std::is_same<char_type, wchar_t>::value,
-                     "Only char* and wchar_t* types are supported.");
-        return std::is_same<char_type, char>::value
-            ? reinterpret_cast<const char_type*>(c)
-            : reinterpret_cast<const char_type*>(w);
-    }
+    /*
+     * Statements that are only compiled when XLFP_STATS is defined, for collecting
+     * the counters returned by tokenize_stats.
+     */
+    #ifdef XLFP_STATS
+    #define XLFP_STATS_ONLY(...) __VA_ARGS__
+    #else
+    #define XLFP_STATS_ONLY(...)
+    #endif
 
     template <typename char_type>
     constexpr char_type _choose_char(char c, wchar_t w)
     {
-        static_assert(std::is_same<char_type, char>::value || std::is_same<char_type, wchar_t>::value,
-                     "Only char and wchar_t types are supported.");
-        return std::is_same<char_type, char>::value ? c : w;
-    }
-
-    inline bool _str_equals(const wchar_t *str1, size_t n1, const wchar_t *str2, size_t n2)
-    {
-        return n1 == n2 && std::wcsncmp(str1, str2, n1) == 0;
+        static_assert(std::is_same<char_type, char>::value ||
+                      std::is_same<char_type, wchar_t>::value ||
+                      (std::is_integral<char_type>::value && std::is_unsigned<char_type>::value),
+                     "Only char, wchar_t and unsigned integer types are supported.");
+        return std::is_same<char_type, char>::value ? static_cast<char_type>(c)
+            : std::is_same<char_type, wchar_t>::value ? static_cast<char_type>(w)
+            : static_cast<char_type>(static_cast<unsigned char>(c));
     }
 
-    inline bool _str_equals(const char* str1, size_t n1, const char* str2, size_t n2)
+    /* Compares a string of any char type with an ASCII literal of length n */
+    template <typename char_type>
+    inline bool _str_equals(const char_type* str, size_t size, const char* literal, size_t n)
     {
-        return n1 == n2 && std::strncmp(str1, str2, n1) == 0;
-    }
+        if (size != n)
+            return false;
 
-    inline size_t _tcslen(const wchar_t *str)
-    {
-        return std::wcslen(str);
-    }
+        for (size_t i = 0; i < n; ++i)
+            if (str[i] != static_cast<char_type>(static_cast<unsigned char>(literal[i])))
+                return false;
 
-    inline size_t _tcslen(const char *str)
-    {
-        return std::strlen(str);
+        return true;
     }
 
     /* thrown by tokenize for any invalid formula */
@@ -122,6 +133,10 @@ namespace xlfparser {
 
         // Character used to separate rows in array literals (;).
         std::optional<char_type> row_separator;
+
+        // Whether formulas start with '='. If false, the first character is the start of the
+        // formula body, as in the formulas stored in XLSX files, and stringify omits the '='.
+        bool leading_equals = true;
     };
 
     /**
@@ -159,7 +174,9 @@ namespace xlfparser {
             Math,
             Concatenation,
             Intersection,
-            Union
+            Union,
+            Name,
+            Spill
         };
 
         Token(size_t start, size_t end, Type type, Subtype subtype):
@@ -210,6 +227,15 @@ namespace xlfparser {
             return string.substr(m_start, m_end + 1 - m_start);
         }
 
+        bool operator==(const Token& other) const {
+            return m_start == other.m_start
+                && m_end == other.m_end
+                && m_type == other.m_type
+                && m_subtype == other.m_subtype;
+        }
+
+        bool operator!=(const Token& other) const { return !(*this == other); }
+
         Type type() const { return m_type; }
         void type(Type t) { m_type = t; }
 
@@ -229,29 +255,494 @@ namespace xlfparser {
         Subtype m_subtype;
     };
 
+#ifdef XLFP_STATS
+    /**
+     * Counters collected while tokenizing, for finding out why some formulas are slow
+     * to tokenize. Only available when built with XLFP_STATS defined.
+     * See tokenize_stats.
+     */
+    struct TokenizeStats
+    {
+        // Characters scanned in each state of the tokenizer
+        uint64_t chars_default = 0;
+        uint64_t chars_in_string = 0;
+        uint64_t chars_in_path = 0;
+        uint64_t chars_in_range = 0;
+        uint64_t chars_in_error = 0;
+
+        // Times a token was checked for scientific notation (eg. 1.5E+3)
+        uint64_t scientific_notation_checks = 0;
+
+        // Whitespace tokens rewritten as intersection operators
+        uint64_t intersections = 0;
+
+        // Deepest nesting of functions, subexpressions and arrays
+        uint64_t max_depth = 0;
+
+        // Tokens returned by tokenize and retokenize, indexed by Token::Type
+        uint64_t tokens[size_t(Token::Type::Whitespace) + 1] = {};
+    };
+
+    /*
+     * Each thread updates its own counters, so no synchronization is needed to update them.
+     * They're atomic only so they can be read safely from other threads.
+     */
+    struct _StatsCounters
+    {
+        enum
+        {
+            CharsDefault,
+            CharsInString,
+            CharsInPath,
+            CharsInRange,
+            CharsInError,
+            ScientificNotationChecks,
+            Intersections,
+            MaxDepth,
+            Tokens,
+            NUM_COUNTERS = Tokens + size_t(Token::Type::Whitespace) + 1
+        };
+
+        std::atomic<uint64_t> values[NUM_COUNTERS] = {};
+
+        void add(size_t counter, uint64_t n)
+        {
+            values[counter].store(values[counter].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+        void max(size_t counter, uint64_t n)
+        {
+            if (n > values[counter].load(std::memory_order_relaxed))
+                values[counter].store(n, std::memory_order_relaxed);
+        }
+
+        static void accumulate(uint64_t* totals, size_t counter, uint64_t value)
+        {
+            if (counter == MaxDepth)
+                totals[counter] = std::max(totals[counter], value);
+            else
+                totals[counter] += value;
+        }
+    };
+
+    /* The counters of all running threads, and the totals from threads that have exited */
+    struct _StatsRegistry
+    {
+        std::mutex mutex;
+        std::vector<_StatsCounters*> threads;
+        uint64_t exited[_StatsCounters::NUM_COUNTERS] = {};
+    };
+
+    inline _StatsRegistry& _stats_registry()
+    {
+        static _StatsRegistry registry;
+        return registry;
+    }
+
+    struct _ThreadStats
+    {
+        _StatsCounters counters;
+
+        _ThreadStats()
+        {
+            auto& registry = _stats_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.threads.push_back(&counters);
+        }
+
+        ~_ThreadStats()
+        {
+            auto& registry = _stats_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            for (size_t i = 0; i < _StatsCounters::NUM_COUNTERS; ++i)
+                _StatsCounters::accumulate(registry.exited, i, counters.values[i].load(std::memory_order_relaxed));
+            registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), &counters));
+        }
+    };
+
+    inline _StatsCounters& _thread_stats()
+    {
+        thread_local _ThreadStats stats;
+        return stats.counters;
+    }
+
+    template <typename iterator_type>
+    inline void _count_tokens(iterator_type first, iterator_type last)
+    {
+        auto& stats = _thread_stats();
+        for (; first != last; ++first)
+            stats.add(_StatsCounters::Tokens + size_t(first->type()), 1);
+    }
+
+    /**
+     * Get the counters collected by all threads since the last call to reset_tokenize_stats.
+     * Only available when built with XLFP_STATS defined.
+     *
+     * @return The totals of the counters for all threads.
+     */
+    inline TokenizeStats tokenize_stats()
+    {
+        uint64_t totals[_StatsCounters::NUM_COUNTERS];
+
+        {
+            auto& registry = _stats_registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            std::copy(std::begin(registry.exited), std::end(registry.exited), totals);
+            for (auto counters : registry.threads)
+                for (size_t i = 0; i < _StatsCounters::NUM_COUNTERS; ++i)
+                    _StatsCounters::accumulate(totals, i, counters->values[i].load(std::memory_order_relaxed));
+        }
+
+        TokenizeStats stats;
+        stats.chars_default = totals[_StatsCounters::CharsDefault];
+        stats.chars_in_string = totals[_StatsCounters::CharsInString];
+        stats.chars_in_path = totals[_StatsCounters::CharsInPath];
+        stats.chars_in_range = totals[_StatsCounters::CharsInRange];
+        stats.chars_in_error = totals[_StatsCounters::CharsInError];
+        stats.scientific_notation_checks = totals[_StatsCounters::ScientificNotationChecks];
+        stats.intersections = totals[_StatsCounters::Intersections];
+        stats.max_depth = totals[_StatsCounters::MaxDepth];
+        std::copy(totals + _StatsCounters::Tokens, totals + _StatsCounters::NUM_COUNTERS, stats.tokens);
+        return stats;
+    }
+
+    /**
+     * Reset the counters of all threads to zero.
+     * Only available when built with XLFP_STATS defined.
+     *
+     * Counts from threads that are tokenizing at the time may be partly lost.
+     */
+    inline void reset_tokenize_stats()
+    {
+        auto& registry = _stats_registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        std::fill(std::begin(registry.exited), std::end(registry.exited), 0);
+        for (auto counters : registry.threads)
+            for (auto& value : counters->values)
+                value.store(0, std::memory_order_relaxed);
+    }
+#endif
+
+    template <typename char_type>
+    inline bool _is_alpha(char_type c)
+    {
+        return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+    }
+
+    template <typename char_type>
+    inline bool _is_digit(char_type c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    template <typename char_type>
+    inline char_type _to_upper(char_type c)
+    {
+        return (c >= 'a' && c <= 'z') ? static_cast<char_type>(c - 'a' + 'A') : c;
+    }
+
+    /*
+     * One side of an A1-style reference, eg. "$B3", "C" or "12".
+     * Rows and columns are 1-based, with 0 meaning that part is not present.
+     */
+    struct _A1Reference
+    {
+        size_t row = 0;
+        size_t col = 0;
+        bool abs_row = false;
+        bool abs_col = false;
+    };
+
     template <typename char_type>
-    inline std::vector<Token> _fix_whitespace_tokens(const std::vector<Token> tokens,
-                                                     const char_type* formula,
-                                                     size_t size)
+    inline bool _parse_a1_reference(const char_type* str, size_t size, _A1Reference& ref)
     {
-        std::vector<Token> new_tokens;
-        new_tokens.reserve(tokens.size());
+        const size_t MAX_ROWS = 1048576;
+        const size_t MAX_COLS = 16384;
 
-        for (auto iter = tokens.begin(); iter != tokens.end(); ++iter)
+        ref = _A1Reference();
+        size_t i = 0;
+
+        bool dollar = (i < size && str[i] == '$');
+        if (dollar)
+            ++i;
+
+        size_t letters = 0;
+        while (i < size && _is_alpha(str[i]) && letters < 3)
         {
-            auto& token = *iter;
+            ref.col = ref.col * 26 + static_cast<size_t>(_to_upper(str[i]) - 'A' + 1);
+            ++letters;
+            ++i;
+        }
+
+        if (letters > 0)
+        {
+            ref.abs_col = dollar;
+            dollar = (i < size && str[i] == '$');
+            if (dollar)
+                ++i;
+        }
+
+        size_t digits = 0;
+        while (i < size && _is_digit(str[i]) && digits < 7)
+        {
+            ref.row = ref.row * 10 + static_cast<size_t>(str[i] - '0');
+            ++digits;
+            ++i;
+        }
+
+        if (digits > 0)
+            ref.abs_row = dollar;
+        else if (dollar)
+            return false;
+
+        return i == size
+            && (letters > 0 || digits > 0)
+            && ref.col <= MAX_COLS
+            && (digits == 0 || (ref.row > 0 && ref.row <= MAX_ROWS));
+    }
+
+    /*
+     * Calls callback(const _A1Reference&) for each part of an A1-style range
+     * (eg. "Sheet1!$A1:B$2") and returns the length of the sheet prefix,
+     * or -1 if the operand isn't an A1-style reference.
+     */
+    template <typename char_type, typename callback_type>
+    inline std::ptrdiff_t _for_each_a1_reference(const char_type* str, size_t size, callback_type&& callback)
+    {
+        size_t prefix = 0;
+        for (size_t i = 0; i < size; ++i)
+            if (str[i] == '!')
+                prefix = i + 1;
+
+        // Parse everything first so the callback only sees valid references
+        _A1Reference refs[3];
+        size_t count = 0;
+        size_t part_start = prefix;
+        for (size_t i = prefix; i <= size; ++i)
+        {
+            if (i < size && str[i] != ':')
+                continue;
+
+            if (count == 3 || !_parse_a1_reference(&str[part_start], i - part_start, refs[count]))
+                return -1;
+
+            ++count;
+            part_start = i + 1;
+        }
+
+        // A single reference must be a cell, whole rows or columns are only valid in a range
+        if (count == 1 && (refs[0].row == 0 || refs[0].col == 0))
+            return -1;
+
+        for (size_t i = 0; i < count; ++i)
+            callback(refs[i]);
+
+        return static_cast<std::ptrdiff_t>(prefix);
+    }
+
+    /* Checks for an R1C1-style reference without any brackets, eg. R1C1, R2, C3:C4 or RC */
+    template <typename char_type>
+    inline bool _is_r1c1_reference(const char_type* str, size_t size)
+    {
+        size_t i = 0;
+        while (i < size)
+        {
+            const size_t part_start = i;
+            if (_to_upper(str[i]) == 'R')
+                while (++i < size && _is_digit(str[i]));
+
+            if (i < size && _to_upper(str[i]) == 'C')
+                while (++i < size && _is_digit(str[i]));
+
+            if (i == part_start || (i < size && str[i] != ':'))
+                return false;
+
+            if (i < size && ++i == size)
+                return false;
+        }
+
+        return size > 0;
+    }
+
+    /* Checks for TRUE or FALSE, in any case */
+    template <typename char_type>
+    inline bool _is_logical(const char_type* str, size_t size)
+    {
+        if (size != 4 && size != 5)
+            return false;
+
+        const char* logical = (size == 4) ? "TRUE" : "FALSE";
+        size_t i = 0;
+        while (i < size && _to_upper(str[i]) == static_cast<unsigned char>(logical[i]))
+            ++i;
+
+        return i == size;
+    }
+
+    /*
+     * Checks for a defined name or a LET or LAMBDA parameter, which start with a letter, '_' or '\'
+     * followed by letters, digits, '_', '\', '.' or '?'. Any non-ASCII character is taken to be a letter.
+     */
+    template <typename char_type>
+    inline bool _is_name(const char_type* str, size_t size)
+    {
+        if (size == 0 || _is_logical(str, size))
+            return false;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            const char_type c = str[i];
+            if (!(_is_alpha(c) || c == '_' || c == '\\' || static_cast<uint32_t>(c) >= 0x80 ||
+                  (i > 0 && (_is_digit(c) || c == '.' || c == '?'))))
+                return false;
+        }
+
+        return true;
+    }
+
+    /*
+     * Get the subtype of an operand that isn't text, a number or an error
+     * using only simple character tests.
+     */
+    template <typename char_type>
+    inline Token::Subtype _classify_operand(const char_type* str, size_t size)
+    {
+        if (size == 0)
+            return Token::Subtype::Range;
+
+        // References and names followed by the spill operator, eg. A1#, Sheet1!B2# or Data#.
+        // Anything else ending in '#', eg. the lone '#' in #N/A#, is left as a range
+        if (str[size - 1] == '#')
+        {
+            size_t prefix = 0;
+            for (size_t i = 0; i + 1 < size; ++i)
+                if (str[i] == '!')
+                    prefix = i + 1;
+
+            const char_type* reference = &str[prefix];
+            const size_t length = size - 1 - prefix;
+
+            if (_for_each_a1_reference(reference, length, [](const _A1Reference&) {}) >= 0 ||
+                _is_r1c1_reference(reference, length) ||
+                _is_name(reference, length))
+                return Token::Subtype::Spill;
+
+            return Token::Subtype::Range;
+        }
+
+        size_t prefix = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            // R1C1 offsets, structured references and quoted sheet names are all ranges, as is
+            // anything with a ':' as names can't contain one, eg. A1:#REF! or the :A1 in #REF!:A1
+            if (str[i] == '[' || str[i] == '\'' || str[i] == ':')
+                return Token::Subtype::Range;
+
+            if (str[i] == '!')
+                prefix = i + 1;
+        }
+
+        const char_type* name = &str[prefix];
+        const size_t length = size - prefix;
+
+        if (prefix == 0 && _is_logical(name, length))
+            return Token::Subtype::Logical;
+
+        if (_for_each_a1_reference(name, length, [](const _A1Reference&) {}) >= 0 || _is_r1c1_reference(name, length))
+            return Token::Subtype::Range;
+
+        // Defined names and LET or LAMBDA parameters, anything else the scanner couldn't make
+        // sense of, eg. the #+1 in #N/A#+1, is left as a range
+        return _is_name(name, length) ? Token::Subtype::Name : Token::Subtype::Range;
+    }
+
+    /*
+     * Checks for the start of a number in scientific notation up to the 'E', eg. "1.5E" in 1.5E+3,
+     * in which case a following + or - is part of the number rather than an operator.
+     */
+    template <typename char_type>
+    inline bool _is_sn_mantissa(const char_type* str, size_t size, char_type decimal_separator)
+    {
+        // [1-9](\.\d+)?E, checking the first and last characters first as most tokens fail those
+        if (size < 2 || str[0] < '1' || str[0] > '9' || (str[size - 1] != 'E' && str[size - 1] != 'e'))
+            return false;
+
+        if (size == 2)
+            return true;
+
+        if (size < 4 || str[1] != decimal_separator)
+            return false;
+
+        for (size_t i = 2; i < size - 1; ++i)
+            if (!_is_digit(str[i]))
+                return false;
+
+        return true;
+    }
+
+    /* Checks for a complete number operand, eg. 12, 1.5 or 1.5E+3 */
+    template <typename char_type>
+    inline bool _is_number(const char_type* str, size_t size, char_type decimal_separator)
+    {
+        // \d+(\.\d+)?(E[+-]\d+)?
+        size_t i = 0;
+        auto digits = [&]() {
+            const size_t first = i;
+            while (i < size && _is_digit(str[i]))
+                ++i;
+            return i > first;
+        };
+
+        if (!digits())
+            return false;
+
+        if (i < size && str[i] == decimal_separator)
+        {
+            ++i;
+            if (!digits())
+                return false;
+        }
+
+        if (i < size && (str[i] == 'E' || str[i] == 'e'))
+        {
+            ++i;
+            if (i >= size || (str[i] != '+' && str[i] != '-'))
+                return false;
+            ++i;
+            if (!digits())
+                return false;
+        }
+
+        return i == size;
+    }
+
+    /*
+     * Label whitespace between two operands, functions or subexpressions as an intersection
+     * operator and drop all other whitespace, compacting tokens[first..] in place.
+     */
+    inline void _fix_whitespace_tokens(std::vector<Token>& tokens, size_t first)
+    {
+        const size_t last = tokens.size();
+        size_t out = first;
+        Token token(0, 0, Token::Type::Unknown, Token::Subtype::None);
+
+        for (size_t i = first; i < last; ++i)
+        {
+            // Keep a copy of the previous token as it may get overwritten
+            const Token previous = token;
+            token = tokens[i];
+
             if (token.type() != Token::Type::Whitespace)
             {
-                new_tokens.push_back(token);
+                tokens[out++] = token;
                 continue;
             }
 
             // Examine the previous and next tokens to see if the whitepsace is actually an intersection operator
-            if (iter == tokens.begin() || iter == tokens.end()-1)
+            if (i == first || i == last-1)
                 continue;
 
-            auto& previous = *(iter-1);
-            auto& next = *(iter+1);
+            const Token& next = tokens[i+1];
 
             // If the previous token is not the end of a function, subexpression or operand skip the whitespace
             if (!((previous.type() == Token::Type::Function && previous.subtype() == Token::Subtype::Stop) ||
@@ -266,28 +757,27 @@ namespace xlfparser {
                 continue;
 
             // Space between functions, subexpressions or operands is an intersection operator
-            new_tokens.push_back({token.start(),
+            XLFP_STATS_ONLY(_thread_stats().add(_StatsCounters::Intersections, 1);)
+            tokens[out++] = Token(token.start(),
                                   token.end(),
                                   Token::Type::OperatorInfix,
-                                  Token::Subtype::Intersection});
+                                  Token::Subtype::Intersection);
         }
 
-        return new_tokens;
+        tokens.resize(out, token);
     }
 
+    /* Set the subtypes of the tokens in [first, last) */
     template <typename char_type>
-    inline void _infer_token_subtypes(std::vector<Token>& tokens,
+    inline void _infer_token_subtypes(std::vector<Token>::iterator first,
+                                      std::vector<Token>::iterator last,
                                       const Options<char_type>& options,
                                       const char_type* formula,
                                       size_t size)
     {
-        std::basic_stringstream<char_type> number_re_ss;
-        number_re_ss << R"(^\d+(\)" << options.decimal_separator.value_or(XLFP_CHAR('.')) << R"(\d+)?(E[+-]\d+)?$)";
-        const std::basic_regex<char_type> number_re(number_re_ss.str(),
-            std::regex_constants::ECMAScript |
-            std::regex_constants::icase);
+        const auto decimal_separator = options.decimal_separator.value_or(XLFP_CHAR('.'));
 
-        for (auto iter = tokens.begin(); iter != tokens.end(); ++iter)
+        for (auto iter = first; iter != last; ++iter)
         {
             auto& token = *iter;
 
@@ -300,7 +790,7 @@ namespace xlfparser {
             {
                 // If the previous token was function, expression, postfix operator or operand, this token
                 // is an infix operator of subtype math.
-                if (iter > tokens.begin())
+                if (iter > first)
                 {
                     auto& previous = *(iter-1);
                     if ((previous.type() == Token::Type::Function && previous.subtype() == Token::Subtype::Stop) ||
@@ -323,7 +813,7 @@ namespace xlfparser {
             {
                 // If the previous token  was function, expression, postfix operator or operand, this token
                 // is an infix operator of subtype math.
-                if (iter > tokens.begin())
+                if (iter > first)
                 {
                     auto& previous = *(iter-1);
                     if ((previous.type() == Token::Type::Function && previous.subtype() == Token::Subtype::Stop) ||
@@ -369,36 +859,56 @@ namespace xlfparser {
                 continue;
             }
 
-            // Set the operand type to Number or Range
+            // Set the operand type to Number, Logical, Range, Spill or Name
             if (token.type() == Token::Type::Operand && token.subtype() == Token::Subtype::None)
             {
-                if (std::regex_match(&formula[token.start()], &formula[token.end()]+1, number_re))
+                if (_is_number(&formula[token.start()], token.end() + 1 - token.start(), decimal_separator))
                 {
                     token.subtype(Token::Subtype::Number);
                 }
                 else
                 {
-                    token.subtype(Token::Subtype::Range);
+                    token.subtype(_classify_operand(&formula[token.start()], token.end() + 1 - token.start()));
                 }
             }
         }
     }
 
-    /**
-     * Generate a vector of Tokens from an Excel formula.
+    inline void _update_stack(std::stack<Token::Type>& stack, const Token& token)
+    {
+        if (token.subtype() == Token::Subtype::Start &&
+            (token.type() == Token::Type::Function ||
+             token.type() == Token::Type::Subexpression ||
+             token.type() == Token::Type::Array ||
+             token.type() == Token::Type::ArrayRow))
+        {
+            stack.push(token.type());
+        }
+        else if (token.subtype() == Token::Subtype::Stop && !stack.empty())
+        {
+            stack.pop();
+        }
+    }
+
+    /*
+     * Scan a formula from index, appending the raw tokens to tokens.
      *
-     * @param formula The Excel formula to tokenize.
-     * @param size Number of characters in the formula string.
-     * @param options Optional tokenize options.
-     * @return A vector of tokens.
+     * index must be at the start of a token, with stack holding the currently open
+     * functions, subexpressions, arrays and array rows. The raw tokens still need
+     * passing through _fix_whitespace_tokens and _infer_token_subtypes.
+     *
+     * at_boundary(index, stack) is called whenever a new token is about to start and
+     * scanning stops if it returns true. Returns the index scanning stopped at.
      */
-    template <typename char_type>
-    inline std::vector<Token> tokenize(const char_type *formula, size_t size, const Options<char_type>& options)
+    template <typename char_type, typename boundary_type>
+    inline size_t _scan_tokens(const char_type *formula,
+                               size_t size,
+                               const Options<char_type>& options,
+                               size_t index,
+                               std::stack<Token::Type>& stack,
+                               std::vector<Token>& tokens,
+                               boundary_type&& at_boundary)
     {
-        // Basic checks to make sure it's a valid formula
-        if (size < 2 || formula[0] != '=')
-            throw invalid_formula("Invalid Excel formula");
-
         // Chars used in parsing excel formual
         const char_type QUOTE_DOUBLE  = XLFP_CHAR('"');
         const char_type QUOTE_SINGLE  = XLFP_CHAR('\'');
@@ -411,53 +921,68 @@ namespace xlfparser {
         const auto left_brace = options.left_brace.value_or(XLFP_CHAR('{'));
         const auto right_brace = options.right_brace.value_or(XLFP_CHAR('}'));
         const auto left_bracket = options.left_bracket.value_or(XLFP_CHAR('['));
-        const auto right_bracket = options.right_brace.value_or(XLFP_CHAR(']'));
+        const auto right_bracket = options.right_bracket.value_or(XLFP_CHAR(']'));
         const auto list_separator = options.list_separator.value_or(XLFP_CHAR(','));
-        const auto decimal_separator = options.decimal_separator.value_or(XLFP_CHAR('.'));
         const auto row_separator = options.row_separator.value_or(XLFP_CHAR(';'));
+        const auto decimal_separator = options.decimal_separator.value_or(XLFP_CHAR('.'));
 
-        const char_type* OPERATORS_INFIX   = XLFP_STRING("+-*/^&=><@");
-        const char_type* OPERATORS_POSTFIX = XLFP_STRING("%");
-
-        // This matches a number in scientific notation with or without numbers after the + or -.
-        // It's used to test for SN numbers before checking for +/- operators.
-        std::basic_stringstream<char_type> sn_regex_ss;
-        sn_regex_ss << R"(^[1-9](\)" << decimal_separator << R"(\d+)?E[+-]\d*$)";
-        const std::basic_regex<char_type> sn_regex(sn_regex_ss.str(),
-            std::regex_constants::ECMAScript |
-            std::regex_constants::icase);
-
-        const char_type* ERRORS[] = {
-                XLFP_STRING("#NULL!"),
-                XLFP_STRING("#DIV/0!"),
-                XLFP_STRING("#VALUE!"),
-                XLFP_STRING("#REF!"),
-                XLFP_STRING("#NAME?"),
-                XLFP_STRING("#NUM!"),
-                XLFP_STRING("#N/A"),
-                XLFP_STRING("#SPILL!"),
+        const char* OPERATORS_INFIX   = "+-*/^&=><@";
+        const char* OPERATORS_POSTFIX = "%";
+
+        const char* ERRORS[] = {
+                "#NULL!",
+                "#DIV/0!",
+                "#VALUE!",
+                "#REF!",
+                "#NAME?",
+                "#NUM!",
+                "#N/A",
+                "#SPILL!",
                 NULL
         };
 
-        const char_type* COMPARATORS_MULTI[] = {
-                XLFP_STRING(">="),
-                XLFP_STRING("<="),
-                XLFP_STRING("<>"),
+        const size_t MAX_ERROR_LENGTH = 7;  // #SPILL! and #DIV/0!
+
+        const char* COMPARATORS_MULTI[] = {
+                ">=",
+                "<=",
+                "<>",
                 NULL
         };
 
         bool in_string = false;
         bool in_path = false;
         bool in_range = false;
+        size_t range_depth = 0;
         bool in_error = false;
 
-        std::vector<Token> tokens;
-        std::stack<Token::Type> stack;
-
-        size_t index = 1;  // first char is always '='
         size_t start = index;  // start of the current token
-        while(index < size && formula[index] != L'\0')
+        const size_t first_token = tokens.size();  // tokens may already hold other formulas' tokens
+
+        // characters are counted against the state they were scanned in
+        XLFP_STATS_ONLY(
+            auto& stats = _thread_stats();
+            size_t stats_index = index;
+            size_t stats_state = _StatsCounters::CharsDefault;
+            auto count_chars = [&]() {
+                stats.add(stats_state, index - stats_index);
+                stats_index = index;
+                stats_state = in_string ? _StatsCounters::CharsInString
+                            : in_path ? _StatsCounters::CharsInPath
+                            : in_range ? _StatsCounters::CharsInRange
+                            : in_error ? _StatsCounters::CharsInError
+                            : _StatsCounters::CharsDefault;
+            };
+        )
+
+        while(index < size && formula[index] != XLFP_CHAR('\0'))
         {
+            XLFP_STATS_ONLY(count_chars();)
+
+            // nothing is accumulated and none of the states below are active between tokens
+            if (start == index && at_boundary(index, stack))
+                return index;
+
             // state-dependent character evaluation (order is important)
 
             // double-quoted strings
@@ -505,12 +1030,21 @@ namespace xlfparser {
                 continue;
             }
 
-            // bracketed strings (R1C1 range index or linked workbook name)
-            // no embeds (changed to "()" by Excel)
+            // bracketed strings (R1C1 range index, linked workbook name or structured reference)
+            // structured references can be nested, eg. Table1[[#This Row],[Amount]]
+            // and use ' to escape special characters in column names
             // end does not mark a token
             if (in_range)
             {
-                if (formula[index] == right_bracket)
+                if (formula[index] == QUOTE_SINGLE && index + 1 < size)
+                {
+                    index += 2;
+                    continue;
+                }
+
+                if (formula[index] == left_bracket)
+                    ++range_depth;
+                else if (formula[index] == right_bracket && --range_depth == 0)
                     in_range = false;
 
                 index++;
@@ -521,9 +1055,10 @@ namespace xlfparser {
             // end marks a token, determined from absolute list of values
             if (in_error)
             {
-                for (auto err = &ERRORS[0]; *err != NULL; ++err)
+                // once it's longer than any error it can't become one, so isn't checked again
+                for (auto err = &ERRORS[0]; *err != NULL && index - start < MAX_ERROR_LENGTH; ++err)
                 {
-                    if (_str_equals(*err, _tcslen(*err), &formula[start], 1 + index - start))
+                    if (_str_equals(&formula[start], 1 + index - start, *err, std::strlen(*err)))
                     {
                         // add the string token, exit the string and continue
                         tokens.push_back(Token(start, index, Token::Type::Operand, Token::Subtype::Error));
@@ -537,10 +1072,11 @@ namespace xlfparser {
                 continue;
             }
 
-            // scientific notation check
-            if (index > start)
+            // scientific notation check, eg. 1.5E+3 where the + isn't an operator
+            if (index > start && (formula[index] == XLFP_CHAR('+') || formula[index] == XLFP_CHAR('-')))
             {
-                if (std::regex_match(&formula[start], &formula[index]+1, sn_regex))
+                XLFP_STATS_ONLY(stats.add(_StatsCounters::ScientificNotationChecks, 1);)
+                if (_is_sn_mantissa(&formula[start], index - start, decimal_separator))
                 {
                     ++index;
                     continue;
@@ -577,6 +1113,15 @@ namespace xlfparser {
             if (formula[index] == left_bracket)
             {
                 in_range = true;
+                range_depth = 1;
+                ++index;
+                continue;
+            }
+
+            // a # after a reference is the spill operator (eg. A1#), not the start of an error,
+            // except after a sheet name (eg. Sheet1!#REF!)
+            if (formula[index] == ERROR_START && index > start && formula[index - 1] != XLFP_CHAR('!'))
+            {
                 ++index;
                 continue;
             }
@@ -608,6 +1153,7 @@ namespace xlfparser {
 
                 stack.push(Token::Type::Array);
                 stack.push(Token::Type::ArrayRow);
+                XLFP_STATS_ONLY(stats.max(_StatsCounters::MaxDepth, stack.size());)
 
                 start = ++index;
                 continue;
@@ -639,12 +1185,16 @@ namespace xlfparser {
                     start = index;
                 }
 
-                if (stack.empty())
+                // the closing brace ends both the current array row and the array
+                if (stack.empty() || stack.top() != Token::Type::ArrayRow)
                     throw invalid_formula("Mismatched braces");
 
                 tokens.push_back(Token(start, index, stack.top(), Token::Subtype::Stop));
                 stack.pop();
 
+                if (stack.empty() || stack.top() != Token::Type::Array)
+                    throw invalid_formula("Mismatched braces");
+
                 tokens.push_back(Token(start, index, stack.top(), Token::Subtype::Stop));
                 stack.pop();
 
@@ -661,7 +1211,7 @@ namespace xlfparser {
                     start = index;
                 }
 
-                while ((formula[index] == WHITESPACE) && (index < size))
+                while (index < size && formula[index] == WHITESPACE)
                     index++;
 
                 tokens.push_back(Token(start, index-1, Token::Type::Whitespace, Token::Subtype::None));
@@ -676,7 +1226,7 @@ namespace xlfparser {
                 bool foundOp = false;
                 for (auto op = &COMPARATORS_MULTI[0]; *op != NULL; ++op)
                 {
-                    if (_str_equals(*op, _tcslen(*op), &formula[index], 2))
+                    if (_str_equals(&formula[index], 2, *op, 2))
                     {
                         if (index > start)
                         {
@@ -700,9 +1250,9 @@ namespace xlfparser {
 
             // standard infix operators
             bool foundOp = false;
-            for (auto op = OPERATORS_INFIX; *op != L'\0'; ++op)
+            for (auto op = OPERATORS_INFIX; *op != '\0'; ++op)
             {
-                if (*op == formula[index])
+                if (formula[index] == static_cast<unsigned char>(*op))
                 {
                     if (index > start)
                     {
@@ -723,9 +1273,9 @@ namespace xlfparser {
             }
 
             // standard postfix operators
-            for (auto op = OPERATORS_POSTFIX; *op != L'\0'; ++op)
+            for (auto op = OPERATORS_POSTFIX; *op != '\0'; ++op)
             {
-                if (*op == formula[index])
+                if (formula[index] == static_cast<unsigned char>(*op))
                 {
                     if (index > start)
                     {
@@ -759,6 +1309,8 @@ namespace xlfparser {
                     stack.push(Token::Type::Subexpression);
                 }
 
+                XLFP_STATS_ONLY(stats.max(_StatsCounters::MaxDepth, stack.size());)
+
                 start = ++index;
                 continue;
             }
@@ -805,20 +1357,74 @@ namespace xlfparser {
             ++index;
         }
 
+        XLFP_STATS_ONLY(count_chars();)
+
         // dump remaining accumulation, if any
-        if (index > start && (tokens.empty() || tokens.back().end() < start))
+        if (index > start && (tokens.size() == first_token || tokens.back().end() < start))
             tokens.push_back(Token(start, index-1, Token::Type::Operand, Token::Subtype::None));
 
-        // label intersection operators specified as whitespace correctly
-        tokens = _fix_whitespace_tokens(tokens, formula, size);
-
-        // set the token subtypes correctly
-        _infer_token_subtypes(tokens, options, formula, size);
+        return index;
+    }
 
-        return tokens;
+    /*
+     * Basic checks to make sure it's a valid formula, returning the index of the
+     * first character after the leading '=' (if the options say there is one).
+     */
+    template <typename char_type>
+    inline size_t _formula_body(const char_type *formula, size_t size, const Options<char_type>& options)
+    {
+        const size_t body = options.leading_equals ? 1 : 0;
+        if (size <= body || (body > 0 && formula[0] != XLFP_CHAR('=')))
+            throw invalid_formula("Invalid Excel formula");
+        return body;
     }
 
-    /**
+    /*
+     * Tokenize a formula, appending the tokens to tokens.
+     *
+     * stack must be empty and is left in an unspecified state. If the formula is invalid
+     * invalid_formula is thrown and tokens may have had some raw tokens appended to it.
+     */
+    template <typename char_type>
+    inline void _tokenize(const char_type *formula,
+                          size_t size,
+                          const Options<char_type>& options,
+                          std::stack<Token::Type>& stack,
+                          std::vector<Token>& tokens)
+    {
+        const size_t body = _formula_body(formula, size, options);
+        const size_t first = tokens.size();
+
+        _scan_tokens(formula, size, options, body, stack, tokens,
+                     [](size_t, const std::stack<Token::Type>&) { return false; });
+
+        // label intersection operators specified as whitespace correctly
+        _fix_whitespace_tokens(tokens, first);
+
+        // set the token subtypes correctly
+        _infer_token_subtypes(tokens.begin() + first, tokens.end(), options, formula, size);
+
+        XLFP_STATS_ONLY(_count_tokens(tokens.begin() + first, tokens.end());)
+    }
+
+    /**
+     * Generate a vector of Tokens from an Excel formula.
+     *
+     * @param formula The Excel formula to tokenize.
+     * @param size Number of characters in the formula string.
+     * @param options Optional tokenize options.
+     * @return A vector of tokens.
+     */
+    template <typename char_type>
+    inline std::vector<Token> tokenize(const char_type *formula, size_t size, const Options<char_type>& options)
+    {
+        std::vector<Token> tokens;
+        std::stack<Token::Type> stack;
+        _tokenize(formula, size, options, stack, tokens);
+        return tokens;
+    }
+
+    /**
      * Generate a vector of Tokens from an Excel formula.
      *
      * @param formula The Excel formula to tokenize.
@@ -882,6 +1488,1194 @@ namespace xlfparser {
     {
         return tokenize(formula.data(), formula.size(), {});
     }
+
+    /**
+     * A contiguous range of Tokens, as returned by TokenBatch.
+     */
+    struct TokenRange
+    {
+        const Token* first;
+        const Token* last;
+
+        const Token* begin() const { return first; }
+        const Token* end() const { return last; }
+        size_t size() const { return static_cast<size_t>(last - first); }
+        bool empty() const { return first == last; }
+        const Token& operator[](size_t i) const { return first[i]; }
+    };
+
+    /**
+     * Tokens for a batch of Excel formulas, stored in a single array.
+     * See also tokenize_batch.
+     *
+     * The tokens for formula i are tokens[offsets[i]] up to, but not including,
+     * tokens[offsets[i+1]]. Formulas that failed to tokenize have no tokens.
+     */
+    struct TokenBatch
+    {
+        enum class Status : unsigned char
+        {
+            Ok,
+            InvalidFormula
+        };
+
+        std::vector<Token> tokens;
+        std::vector<size_t> offsets{0};  // one more than the number of formulas
+        std::vector<Status> status;
+
+        /* Number of formulas in the batch. */
+        size_t size() const { return status.size(); }
+
+        /* Tokens for formula i. */
+        TokenRange operator[](size_t i) const
+        {
+            const Token* data = tokens.data();
+            return {data + offsets[i], data + offsets[i + 1]};
+        }
+    };
+
+    /*
+     * Tokenize the formulas in [first, last), appending them to batch.
+     */
+    template <typename iterator_type, typename char_type>
+    inline void _tokenize_batch(iterator_type first,
+                                iterator_type last,
+                                const Options<char_type>& options,
+                                TokenBatch& batch)
+    {
+        // Reserve enough for a typical formula up front to avoid repeatedly growing the arrays
+        size_t count = 0;
+        size_t chars = 0;
+        for (auto iter = first; iter != last; ++iter, ++count)
+            chars += std::basic_string_view<char_type>(*iter).size();
+
+        auto reserve = [](auto& vector, size_t extra) {
+            // Keep growing geometrically when appending to the same batch repeatedly
+            if (vector.size() + extra > vector.capacity())
+                vector.reserve(std::max(vector.size() + extra, vector.capacity() * 2));
+        };
+
+        reserve(batch.tokens, chars / 2);
+        reserve(batch.offsets, count);
+        reserve(batch.status, count);
+
+        // The stack is shared by all formulas in the batch
+        std::stack<Token::Type> stack;
+
+        for (; first != last; ++first)
+        {
+            const std::basic_string_view<char_type> formula(*first);
+            const size_t start = batch.tokens.size();
+            auto status = TokenBatch::Status::Ok;
+
+            try
+            {
+                _tokenize(formula.data(), formula.size(), options, stack, batch.tokens);
+            }
+            catch (const invalid_formula&)
+            {
+                batch.tokens.erase(batch.tokens.begin() + start, batch.tokens.end());
+                status = TokenBatch::Status::InvalidFormula;
+            }
+
+            while (!stack.empty())
+                stack.pop();
+
+            batch.offsets.push_back(batch.tokens.size());
+            batch.status.push_back(status);
+        }
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas.
+     *
+     * The tokens for all the formulas are stored in a single array rather than
+     * one vector per formula. Invalid formulas don't stop the batch, and are
+     * reported in the status of the returned batch instead.
+     *
+     * @param formulas Array of Excel formulas to tokenize.
+     * @param count Number of formulas in the array.
+     * @param options Options controlling how the Excel formulas are tokenized.
+     * @return The tokens for all the formulas.
+     */
+    template <typename char_type>
+    inline TokenBatch tokenize_batch(const std::basic_string_view<char_type>* formulas,
+                                     size_t count,
+                                     const Options<char_type>& options)
+    {
+        TokenBatch batch;
+        _tokenize_batch(formulas, formulas + count, options, batch);
+        return batch;
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas.
+     *
+     * @param formulas Array of Excel formulas to tokenize.
+     * @param count Number of formulas in the array.
+     * @return The tokens for all the formulas.
+     */
+    template <typename char_type>
+    inline TokenBatch tokenize_batch(const std::basic_string_view<char_type>* formulas, size_t count)
+    {
+        return tokenize_batch(formulas, count, {});
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas.
+     *
+     * @param formulas Container of Excel formula strings or string views.
+     * @param options Options controlling how the Excel formulas are tokenized.
+     * @return The tokens for all the formulas.
+     */
+    template <typename range_type, typename char_type = typename range_type::value_type::value_type>
+    inline TokenBatch tokenize_batch(const range_type& formulas, const Options<char_type>& options)
+    {
+        TokenBatch batch;
+        _tokenize_batch(std::begin(formulas), std::end(formulas), options, batch);
+        return batch;
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas.
+     *
+     * @param formulas Container of Excel formula strings or string views.
+     * @return The tokens for all the formulas.
+     */
+    template <typename range_type, typename char_type = typename range_type::value_type::value_type>
+    inline TokenBatch tokenize_batch(const range_type& formulas)
+    {
+        return tokenize_batch(formulas, Options<char_type>{});
+    }
+
+    /**
+     * Update a vector of Tokens after an edit to the Excel formula it was created from.
+     *
+     * Only the part of the formula around the edit is scanned again. Scanning restarts
+     * from the last token before the edit and stops as soon as the new tokens line up
+     * with the old ones after the edit, at which point the remaining old tokens are
+     * reused with their offsets shifted. The result is the same as calling tokenize
+     * on the edited formula.
+     *
+     * @param previous Tokens returned by tokenize for the formula before the edit.
+     * @param formula The Excel formula after the edit.
+     * @param size Number of characters in the formula string.
+     * @param edit_offset Index in the formula where the edit starts.
+     * @param removed Number of characters removed from the old formula at edit_offset.
+     * @param inserted Number of characters inserted into the new formula at edit_offset.
+     * @param options Options used when tokenizing the formula before the edit.
+     * @return A vector of tokens.
+     */
+    template <typename char_type>
+    inline std::vector<Token> retokenize(const std::vector<Token>& previous,
+                                         const char_type* formula,
+                                         size_t size,
+                                         size_t edit_offset,
+                                         size_t removed,
+                                         size_t inserted,
+                                         const Options<char_type>& options)
+    {
+        _formula_body(formula, size, options);
+
+        if (edit_offset + inserted > size)
+            throw std::out_of_range("Edit out of range");
+
+        // Start again from the last token starting before the edit, as the edit may extend it
+        auto first = std::partition_point(previous.begin(), previous.end(), [=](const Token& token) {
+            return token.start() < edit_offset;
+        });
+
+        if (first != previous.begin())
+            --first;
+
+        // Array braces and row separators produce more than one token from the same character
+        while (first != previous.begin() && (first - 1)->start() == first->start())
+            --first;
+
+        // Whitespace intersections depend on the token after them, which may be changing
+        while (first != previous.begin()
+                && (first - 1)->type() == Token::Type::OperatorInfix
+                && (first - 1)->subtype() == Token::Subtype::Intersection)
+            --first;
+
+        if (edit_offset == 0 || first == previous.begin())
+            return tokenize(formula, size, options);
+
+        std::vector<Token> tokens;
+        tokens.reserve(previous.size() + inserted);
+        tokens.assign(previous.begin(), first);
+
+        std::stack<Token::Type> stack;
+        for (const auto& token : tokens)
+            _update_stack(stack, token);
+
+        // Include any whitespace before the first token as it may be an intersection after the edit
+        size_t index = first->start();
+        while (index - 1 > tokens.back().end() && formula[index - 1] == XLFP_CHAR(' '))
+            --index;
+
+        // Follow the old tokens along with the new ones to find where they line up
+        auto tail = first;
+        std::stack<Token::Type> tail_stack = stack;
+        bool resynced = false;
+
+        _scan_tokens(formula, size, options, index, stack, tokens,
+            [&](size_t next, const std::stack<Token::Type>& open) {
+                if (next < edit_offset + inserted)
+                    return false;
+
+                const size_t old_next = next - inserted + removed;
+                while (tail != previous.end() && tail->start() < old_next)
+                    _update_stack(tail_stack, *tail++);
+
+                // Operators are skipped as they may be prefix or infix depending on the token before them
+                resynced = tail != previous.end()
+                    && tail->start() == old_next
+                    && tail->type() != Token::Type::OperatorPrefix
+                    && tail->type() != Token::Type::OperatorInfix
+                    && open == tail_stack;
+
+                return resynced;
+            });
+
+        if (resynced)
+        {
+            for (; tail != previous.end(); ++tail)
+            {
+                tokens.push_back(*tail);
+                tokens.back().start(tail->start() + inserted - removed);
+                tokens.back().end(tail->end() + inserted - removed);
+            }
+        }
+
+        // The tokens from before and after the edit are unaffected by these
+        _fix_whitespace_tokens(tokens, 0);
+        _infer_token_subtypes(tokens.begin(), tokens.end(), options, formula, size);
+
+        XLFP_STATS_ONLY(_count_tokens(tokens.begin(), tokens.end());)
+
+        return tokens;
+    }
+
+    /**
+     * Update a vector of Tokens after an edit to the Excel formula it was created from.
+     *
+     * @param previous Tokens returned by tokenize for the formula before the edit.
+     * @param formula The Excel formula after the edit.
+     * @param size Number of characters in the formula string.
+     * @param edit_offset Index in the formula where the edit starts.
+     * @param removed Number of characters removed from the old formula at edit_offset.
+     * @param inserted Number of characters inserted into the new formula at edit_offset.
+     * @return A vector of tokens.
+     */
+    template <typename char_type>
+    inline std::vector<Token> retokenize(const std::vector<Token>& previous,
+                                         const char_type* formula,
+                                         size_t size,
+                                         size_t edit_offset,
+                                         size_t removed,
+                                         size_t inserted)
+    {
+        return retokenize(previous, formula, size, edit_offset, removed, inserted, {});
+    }
+
+   /**
+    * Update a vector of Tokens after an edit to the Excel formula it was created from.
+    *
+    * @param previous Tokens returned by tokenize for the formula before the edit.
+    * @param formula The Excel formula after the edit.
+    * @param edit_offset Index in the formula where the edit starts.
+    * @param removed Number of characters removed from the old formula at edit_offset.
+    * @param inserted Number of characters inserted into the new formula at edit_offset.
+    * @param options Options used when tokenizing the formula before the edit.
+    * @return A vector of tokens.
+    */
+    template<typename string_type>
+    inline std::vector<Token> retokenize(const std::vector<Token>& previous,
+                                         const string_type& formula,
+                                         size_t edit_offset,
+                                         size_t removed,
+                                         size_t inserted,
+                                         const Options<typename string_type::value_type>& options)
+    {
+        return retokenize(previous, formula.data(), formula.size(), edit_offset, removed, inserted, options);
+    }
+
+   /**
+    * Update a vector of Tokens after an edit to the Excel formula it was created from.
+    *
+    * @param previous Tokens returned by tokenize for the formula before the edit.
+    * @param formula The Excel formula after the edit.
+    * @param edit_offset Index in the formula where the edit starts.
+    * @param removed Number of characters removed from the old formula at edit_offset.
+    * @param inserted Number of characters inserted into the new formula at edit_offset.
+    * @return A vector of tokens.
+    */
+    template<typename string_type>
+    inline std::vector<Token> retokenize(const std::vector<Token>& previous,
+                                         const string_type& formula,
+                                         size_t edit_offset,
+                                         size_t removed,
+                                         size_t inserted)
+    {
+        return retokenize(previous, formula.data(), formula.size(), edit_offset, removed, inserted, {});
+    }
+
+    /**
+     * Convert a vector of tokens back into an Excel formula.
+     *
+     * The separators, decimal points and braces are written using the characters from options,
+     * which may be different from those used when the formula was tokenized.
+     * This can be used to convert formulas between locales,
+     * eg. from "=SUM(1,5;2)" to "=SUM(1.5,2)".
+     *
+     * Brackets are part of the reference operands (eg. R[1]C[1] or Table1[Col]) and are
+     * copied as they are, so the left_bracket and right_bracket options are not used.
+     *
+     * Whitespace that isn't an intersection operator is not included in the result.
+     *
+     * @param tokens Tokens returned by tokenize for formula.
+     * @param formula The Excel formula used to create the tokens.
+     * @param size Number of characters in the formula string.
+     * @param options Options controlling the characters used in the result.
+     * @return The Excel formula as a string.
+     */
+    template <typename char_type,
+              typename traits_type = std::char_traits<char_type>,
+              typename alloc_type = std::allocator<char_type>>
+    inline std::basic_string<char_type, traits_type, alloc_type> stringify(const std::vector<Token>& tokens,
+                                                                            const char_type* formula,
+                                                                            size_t size,
+                                                                            const Options<char_type>& options)
+    {
+        const auto left_brace = options.left_brace.value_or(XLFP_CHAR('{'));
+        const auto right_brace = options.right_brace.value_or(XLFP_CHAR('}'));
+        const auto list_separator = options.list_separator.value_or(XLFP_CHAR(','));
+        const auto decimal_separator = options.decimal_separator.value_or(XLFP_CHAR('.'));
+        const auto row_separator = options.row_separator.value_or(XLFP_CHAR(';'));
+
+        // Only the function tokens add characters, so the result is rarely longer than the input
+        std::basic_string<char_type, traits_type, alloc_type> result;
+        result.reserve(size + 1);
+        if (options.leading_equals)
+            result.push_back(XLFP_CHAR('='));
+
+        for (auto iter = tokens.begin(); iter != tokens.end(); ++iter)
+        {
+            auto& token = *iter;
+
+            if (token.start() >= size || token.end() >= size || token.start() > token.end())
+                throw invalid_token("Token index out of range");
+
+            const char_type* value = &formula[token.start()];
+            const size_t length = token.end() + 1 - token.start();
+
+            switch (token.type())
+            {
+                case Token::Type::Operand:
+                    if (token.subtype() == Token::Subtype::Number)
+                    {
+                        // The only character in a number that isn't a digit or part of the exponent is the decimal point
+                        for (size_t i = 0; i < length; ++i)
+                        {
+                            const auto c = value[i];
+                            if (_is_digit(c) || c == 'E' || c == 'e' || c == '+' || c == '-')
+                                result.push_back(c);
+                            else
+                                result.push_back(decimal_separator);
+                        }
+                        break;
+                    }
+
+                    result.append(value, length);
+                    break;
+
+                case Token::Type::Function:
+                    if (token.subtype() == Token::Subtype::Start)
+                    {
+                        result.append(value, length);
+                        result.push_back(XLFP_CHAR('('));
+                    }
+                    else
+                    {
+                        result.push_back(XLFP_CHAR(')'));
+                    }
+                    break;
+
+                case Token::Type::Array:
+                    result.push_back(token.subtype() == Token::Subtype::Start ? left_brace : right_brace);
+                    break;
+
+                case Token::Type::ArrayRow:
+                    // Rows are separated rather than terminated, so skip the separator after the last row
+                    if (token.subtype() == Token::Subtype::Stop &&
+                        (iter + 1 == tokens.end() || (iter + 1)->type() != Token::Type::Array))
+                        result.push_back(row_separator);
+                    break;
+
+                case Token::Type::Argument:
+                    result.push_back(list_separator);
+                    break;
+
+                case Token::Type::OperatorInfix:
+                    if (token.subtype() == Token::Subtype::Union)
+                    {
+                        result.push_back(list_separator);
+                        break;
+                    }
+
+                    result.append(value, length);
+                    break;
+
+                case Token::Type::Whitespace:
+                    break;
+
+                default:
+                    result.append(value, length);
+                    break;
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * Convert a vector of tokens back into an Excel formula using the default separators.
+     *
+     * @param tokens Tokens returned by tokenize for formula.
+     * @param formula The Excel formula used to create the tokens.
+     * @param size Number of characters in the formula string.
+     * @return The Excel formula as a string.
+     */
+    template <typename char_type>
+    inline std::basic_string<char_type> stringify(const std::vector<Token>& tokens, const char_type* formula, size_t size)
+    {
+        return stringify(tokens, formula, size, Options<char_type>());
+    }
+
+   /**
+    * Convert a vector of tokens back into an Excel formula.
+    *
+    * @param tokens Tokens returned by tokenize for formula.
+    * @param formula The Excel formula used to create the tokens.
+    * @param options Options controlling the characters used in the result.
+    * @return The Excel formula as a string.
+    */
+    template<typename string_type>
+    inline string_type stringify(const std::vector<Token>& tokens,
+                                 const string_type& formula,
+                                 const Options<typename string_type::value_type>& options)
+    {
+        typedef typename string_type::value_type char_type;
+        typedef typename string_type::traits_type traits_type;
+        return stringify<char_type, traits_type, typename string_type::allocator_type>(
+            tokens, formula.data(), formula.size(), options);
+    }
+
+   /**
+    * Convert a vector of tokens back into an Excel formula using the default separators.
+    *
+    * @param tokens Tokens returned by tokenize for formula.
+    * @param formula The Excel formula used to create the tokens.
+    * @return The Excel formula as a string.
+    */
+    template<typename string_type>
+    inline string_type stringify(const std::vector<Token>& tokens, const string_type& formula)
+    {
+        return stringify(tokens, formula, Options<typename string_type::value_type>());
+    }
+
+   /**
+    * Convert a vector of tokens back into an Excel formula.
+    *
+    * @param tokens Tokens returned by tokenize for formula.
+    * @param formula The Excel formula used to create the tokens.
+    * @param options Options controlling the characters used in the result.
+    * @return The Excel formula as a string.
+    */
+    template<typename char_type>
+    inline std::basic_string<char_type> stringify(const std::vector<Token>& tokens,
+                                                  std::basic_string_view<char_type> formula,
+                                                  const Options<char_type>& options)
+    {
+        return stringify(tokens, formula.data(), formula.size(), options);
+    }
+
+   /**
+    * Convert a vector of tokens back into an Excel formula using the default separators.
+    *
+    * @param tokens Tokens returned by tokenize for formula.
+    * @param formula The Excel formula used to create the tokens.
+    * @return The Excel formula as a string.
+    */
+    template<typename char_type>
+    inline std::basic_string<char_type> stringify(const std::vector<Token>& tokens, std::basic_string_view<char_type> formula)
+    {
+        return stringify(tokens, formula.data(), formula.size(), Options<char_type>());
+    }
+
+    /**
+     * Index of the structure of a tokenized formula.
+     *
+     * Built with a single pass over the tokens, after which finding the matching
+     * Start or Stop token, the enclosing function or the tokens making up a
+     * function argument are all constant time lookups.
+     *
+     * Indexes passed to and returned from the index are positions in the tokens
+     * vector the index was built from, or npos.
+     */
+    class TokenIndex
+    {
+    public:
+        static constexpr size_t npos = static_cast<size_t>(-1);
+
+        explicit TokenIndex(const std::vector<Token>& tokens)
+            : m_entries(tokens.size())
+        {
+            // Open functions, subexpressions, arrays and array rows
+            std::vector<size_t> open;
+            size_t num_separators = 0;
+
+            for (size_t i = 0; i < tokens.size(); ++i)
+            {
+                const Token& token = tokens[i];
+                Entry& entry = m_entries[i];
+
+                if (token.subtype() == Token::Subtype::Stop && !open.empty())
+                {
+                    entry.partner = open.back();
+                    m_entries[open.back()].partner = i;
+                    open.pop_back();
+                }
+
+                entry.depth = open.size();
+                entry.parent = open.empty() ? npos : open.back();
+                if (entry.parent != npos)
+                {
+                    const Entry& parent = m_entries[entry.parent];
+                    if (tokens[entry.parent].type() == Token::Type::Function)
+                    {
+                        entry.function = entry.parent;
+                        entry.argument = parent.separators;
+                    }
+                    else
+                    {
+                        entry.function = parent.function;
+                        entry.argument = parent.argument;
+                    }
+                }
+
+                if (token.type() == Token::Type::Argument && entry.function == entry.parent && entry.parent != npos)
+                {
+                    ++m_entries[entry.parent].separators;
+                    ++num_separators;
+                }
+
+                if (token.subtype() == Token::Subtype::Start &&
+                    (token.type() == Token::Type::Function ||
+                     token.type() == Token::Type::Subexpression ||
+                     token.type() == Token::Type::Array ||
+                     token.type() == Token::Type::ArrayRow))
+                {
+                    open.push_back(i);
+                }
+            }
+
+            // Store each function's argument separators together so the nth argument can be found directly
+            m_separators.resize(num_separators);
+            size_t offset = 0;
+            for (size_t i = 0; i < tokens.size(); ++i)
+            {
+                if (tokens[i].type() == Token::Type::Function && tokens[i].subtype() == Token::Subtype::Start)
+                {
+                    m_entries[i].first_separator = offset;
+                    offset += m_entries[i].separators;
+                }
+            }
+
+            for (size_t i = 0; i < tokens.size(); ++i)
+            {
+                const Entry& entry = m_entries[i];
+                if (tokens[i].type() == Token::Type::Argument && entry.function == entry.parent && entry.parent != npos)
+                    m_separators[m_entries[entry.parent].first_separator + entry.argument] = i;
+            }
+        }
+
+        /* Number of tokens in the index. */
+        size_t size() const { return m_entries.size(); }
+
+        /* Matching Stop token for a Start token and vice versa, or npos for other tokens. */
+        size_t partner(size_t i) const { return m_entries.at(i).partner; }
+
+        /* Number of functions, subexpressions, arrays and array rows containing a token. */
+        size_t depth(size_t i) const { return m_entries.at(i).depth; }
+
+        /* Innermost Start token containing a token, or npos at the top level. */
+        size_t parent(size_t i) const { return m_entries.at(i).parent; }
+
+        /* Innermost function Start token containing a token, or npos if not inside a function. */
+        size_t function(size_t i) const { return m_entries.at(i).function; }
+
+        /*
+         * 0-based index of the argument of function(i) containing a token,
+         * or npos if not inside a function. Argument separators belong to the
+         * argument they end.
+         */
+        size_t argument(size_t i) const { return m_entries.at(i).argument; }
+
+        /* Number of arguments passed to a function, given its Start token. */
+        size_t argument_count(size_t function) const
+        {
+            const Entry& entry = m_entries.at(function);
+            const size_t end = (entry.partner == npos) ? m_entries.size() : entry.partner;
+            if (end == function + 1)
+                return 0;
+            return entry.separators + 1;
+        }
+
+        /*
+         * Innermost function call containing a character in the formula, given the
+         * tokens the index was built from. The function name and its parentheses are
+         * part of the call. Returns the function's Start token or npos.
+         */
+        size_t enclosing_function(const std::vector<Token>& tokens, size_t offset) const
+        {
+            // Last token starting at or before the offset
+            auto iter = std::partition_point(tokens.begin(), tokens.end(), [=](const Token& token) {
+                return token.start() <= offset;
+            });
+
+            if (iter == tokens.begin())
+                return npos;
+
+            const size_t i = static_cast<size_t>(iter - tokens.begin()) - 1;
+            const Token& token = tokens[i];
+
+            if (token.type() == Token::Type::Function)
+            {
+                if (token.subtype() == Token::Subtype::Start)
+                    return i;
+
+                if (offset <= token.end())
+                    return partner(i);
+            }
+
+            return function(i);
+        }
+
+        /*
+         * Range of tokens [first, last) making up the nth argument of a function,
+         * given its Start token.
+         */
+        std::pair<size_t, size_t> argument_tokens(size_t function, size_t n) const
+        {
+            const Entry& entry = m_entries.at(function);
+            if (n >= argument_count(function))
+                throw std::out_of_range("Argument index out of range");
+
+            const size_t first = (n == 0) ? function + 1 : m_separators[entry.first_separator + n - 1] + 1;
+            const size_t last = (n < entry.separators)
+                ? m_separators[entry.first_separator + n]
+                : ((entry.partner == npos) ? m_entries.size() : entry.partner);
+
+            return std::make_pair(first, last);
+        }
+
+    private:
+        struct Entry
+        {
+            size_t partner = npos;
+            size_t parent = npos;
+            size_t function = npos;
+            size_t argument = npos;
+            size_t depth = 0;
+            size_t separators = 0;       // only used for function Start tokens
+            size_t first_separator = 0;  // only used for function Start tokens
+        };
+
+        std::vector<Entry> m_entries;
+        std::vector<size_t> m_separators;
+    };
+
+    /**
+     * Find the token containing a character in the formula.
+     *
+     * This is a binary search over the token start offsets. The opening parenthesis
+     * of a function call is part of the function's Start token. Where more than one
+     * token starts at the same character (eg. array braces) the first is returned.
+     *
+     * @param tokens Tokens returned by tokenize.
+     * @param offset Index of the character in the formula.
+     * @return Index of the token, or TokenIndex::npos if the character is not part of any token.
+     */
+    inline size_t find_token(const std::vector<Token>& tokens, size_t offset)
+    {
+        auto iter = std::partition_point(tokens.begin(), tokens.end(), [=](const Token& token) {
+            return token.start() <= offset;
+        });
+
+        if (iter == tokens.begin())
+            return TokenIndex::npos;
+
+        size_t i = static_cast<size_t>(iter - tokens.begin()) - 1;
+        while (i > 0 && tokens[i - 1].start() == tokens[i].start())
+            --i;
+
+        const Token& token = tokens[i];
+        if (offset <= token.end())
+            return i;
+
+        if (token.type() == Token::Type::Function && token.subtype() == Token::Subtype::Start && offset == token.end() + 1)
+            return i;
+
+        return TokenIndex::npos;
+    }
+
+    /**
+     * The parts of a structured table reference, eg. Table1[[#This Row],[Amount]].
+     * See parse_structured_reference.
+     */
+    template <typename char_type>
+    struct StructuredReference
+    {
+        // Item specifiers, eg. [#All]. Combined as bit flags in items.
+        enum Item
+        {
+            All = 1,
+            Data = 2,
+            Headers = 4,
+            Totals = 8,
+            ThisRow = 16
+        };
+
+        // Table name, empty for references within a table (eg. [@Amount]).
+        std::basic_string_view<char_type> table;
+
+        // Combination of Item flags, 0 if no items are specified.
+        unsigned items = 0;
+
+        // First and last column names of a column range. Both are empty if no columns
+        // are specified and the same for a single column. Names still include any ' escapes.
+        std::basic_string_view<char_type> first_column;
+        std::basic_string_view<char_type> last_column;
+    };
+
+    /*
+     * Find the end of a bracketed part of a structured reference starting at index,
+     * returning the index of the closing bracket or size if there isn't one.
+     */
+    template <typename char_type>
+    inline size_t _find_closing_bracket(const char_type* str, size_t size, size_t index,
+                                        char_type left_bracket, char_type right_bracket)
+    {
+        size_t depth = 0;
+        for (; index < size; ++index)
+        {
+            if (str[index] == XLFP_CHAR('\''))
+                ++index;
+            else if (str[index] == left_bracket)
+                ++depth;
+            else if (str[index] == right_bracket && --depth == 0)
+                return index;
+        }
+        return size;
+    }
+
+    template <typename char_type>
+    inline bool _parse_structured_item(std::basic_string_view<char_type> name, unsigned& items)
+    {
+        typedef StructuredReference<char_type> ref_type;
+        const std::pair<const char*, unsigned> ITEMS[] = {
+            {"#All", ref_type::All},
+            {"#Data", ref_type::Data},
+            {"#Headers", ref_type::Headers},
+            {"#Totals", ref_type::Totals},
+            {"#This Row", ref_type::ThisRow}
+        };
+
+        for (const auto& item : ITEMS)
+        {
+            const size_t length = std::strlen(item.first);
+            if (length != name.size())
+                continue;
+
+            size_t i = 0;
+            while (i < length && _to_upper(name[i]) == _to_upper(static_cast<char_type>(item.first[i])))
+                ++i;
+
+            if (i == length)
+            {
+                items |= item.second;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * Split a structured table reference into the table, item specifiers and columns.
+     *
+     * Handles all forms of structured reference, including Table1[Amount], Table1[#Totals],
+     * Table1[@[Unit Price]], [@Amount] and Table1[[#Headers],[#Data],[Price]:[Amount]].
+     * The parts are views into the formula, so no strings are copied.
+     *
+     * @param token Operand token returned by tokenize for the formula.
+     * @param formula The Excel formula used to create the token.
+     * @param size Number of characters in the formula string.
+     * @param result Set to the parts of the structured reference.
+     * @param options Options used when tokenizing the formula.
+     * @return False if the token is not a structured reference.
+     */
+    template <typename char_type>
+    inline bool parse_structured_reference(const Token& token,
+                                           const char_type* formula,
+                                           size_t size,
+                                           StructuredReference<char_type>& result,
+                                           const Options<char_type>& options)
+    {
+        const auto left_bracket = options.left_bracket.value_or(XLFP_CHAR('['));
+        const auto right_bracket = options.right_bracket.value_or(XLFP_CHAR(']'));
+
+        if (token.type() != Token::Type::Operand || token.end() >= size || token.start() > token.end())
+            return false;
+
+        const char_type* str = &formula[token.start()];
+        const size_t length = token.end() + 1 - token.start();
+
+        // Table name up to the first bracket, and a single bracketed body to the end of the token
+        size_t open = 0;
+        while (open < length && str[open] != left_bracket)
+            ++open;
+
+        if (open == length || _find_closing_bracket(str, length, open, left_bracket, right_bracket) != length - 1)
+            return false;
+
+        // R1C1 references with a bracketed offset at the end look similar, eg. R1C[2]
+        size_t r1c1 = 0;
+        if (r1c1 < open && _to_upper(str[r1c1]) == XLFP_CHAR('R'))
+            while (++r1c1 < open && _is_digit(str[r1c1]));
+        if (r1c1 < open && _to_upper(str[r1c1]) == XLFP_CHAR('C'))
+            ++r1c1;
+        if (r1c1 > 0 && r1c1 == open)
+            return false;
+
+        StructuredReference<char_type> ref;
+        ref.table = std::basic_string_view<char_type>(str, open);
+
+        const size_t body_start = open + 1;
+        const size_t body_end = length - 1;
+
+        // Simple form with no nested brackets, eg. Table1[Amount], Table1[#All] or [@Amount]
+        bool nested = false;
+        for (size_t i = body_start; i < body_end; ++i)
+        {
+            if (str[i] == XLFP_CHAR('\''))
+                ++i;
+            else if (str[i] == left_bracket)
+                nested = true;
+        }
+
+        if (!nested)
+        {
+            std::basic_string_view<char_type> name(&str[body_start], body_end - body_start);
+            if (!name.empty() && name[0] == XLFP_CHAR('#'))
+            {
+                if (!_parse_structured_item(name, ref.items))
+                    return false;
+            }
+            else
+            {
+                if (!name.empty() && name[0] == XLFP_CHAR('@'))
+                {
+                    ref.items |= StructuredReference<char_type>::ThisRow;
+                    name.remove_prefix(1);
+                }
+
+                ref.first_column = ref.last_column = name;
+            }
+
+            result = ref;
+            return true;
+        }
+
+        // Nested form, a list of bracketed items and columns, eg. [[#Data],[Price]:[Amount]] or [@[Unit Price]]
+        bool in_column_range = false;
+        size_t i = body_start;
+        while (i < body_end)
+        {
+            const auto c = str[i];
+            if (c == XLFP_CHAR(' ') || c == XLFP_CHAR(','))
+            {
+                ++i;
+                continue;
+            }
+
+            if (c == XLFP_CHAR('@'))
+            {
+                ref.items |= StructuredReference<char_type>::ThisRow;
+                ++i;
+                continue;
+            }
+
+            if (c == XLFP_CHAR(':'))
+            {
+                if (ref.first_column.empty() || in_column_range)
+                    return false;
+
+                in_column_range = true;
+                ++i;
+                continue;
+            }
+
+            if (c != left_bracket)
+                return false;
+
+            const size_t close = _find_closing_bracket(str, body_end, i, left_bracket, right_bracket);
+            if (close == body_end)
+                return false;
+
+            std::basic_string_view<char_type> name(&str[i + 1], close - i - 1);
+            if (!name.empty() && name[0] == XLFP_CHAR('#'))
+            {
+                if (in_column_range || !_parse_structured_item(name, ref.items))
+                    return false;
+            }
+            else if (in_column_range)
+            {
+                ref.last_column = name;
+                in_column_range = false;
+            }
+            else
+            {
+                if (!ref.first_column.empty())
+                    return false;
+
+                ref.first_column = ref.last_column = name;
+            }
+
+            i = close + 1;
+        }
+
+        if (in_column_range)
+            return false;
+
+        result = ref;
+        return true;
+    }
+
+    /**
+     * Split a structured table reference into the table, item specifiers and columns.
+     *
+     * @param token Operand token returned by tokenize for the formula.
+     * @param formula The Excel formula used to create the token.
+     * @param size Number of characters in the formula string.
+     * @param result Set to the parts of the structured reference.
+     * @return False if the token is not a structured reference.
+     */
+    template <typename char_type>
+    inline bool parse_structured_reference(const Token& token,
+                                           const char_type* formula,
+                                           size_t size,
+                                           StructuredReference<char_type>& result)
+    {
+        return parse_structured_reference(token, formula, size, result, Options<char_type>());
+    }
+
+    /*
+     * FNV-1a hash used by fingerprint.
+     * Values are always hashed as little-endian 64 bit integers so the result
+     * doesn't depend on the platform or on the character type of the formula.
+     */
+    inline uint64_t _fnv1a(uint64_t hash, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i)
+        {
+            hash ^= (value >> (i * 8)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    template <typename char_type>
+    inline uint64_t _fnv1a(uint64_t hash, const char_type* str, size_t size, bool fold_case)
+    {
+        hash = _fnv1a(hash, size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            auto c = fold_case ? _to_upper(str[i]) : str[i];
+            hash = _fnv1a(hash, static_cast<uint64_t>(static_cast<uint32_t>(c)));
+        }
+        return hash;
+    }
+
+    /**
+     * Compute a fingerprint of an already tokenized Excel formula.
+     * See fingerprint(formula, size, host_row, host_col, options).
+     *
+     * @param tokens Tokens returned by tokenize for formula.
+     * @param formula The Excel formula used to create the tokens.
+     * @param size Number of characters in the formula string.
+     * @param host_row 1-based row of the cell containing the formula.
+     * @param host_col 1-based column of the cell containing the formula.
+     * @return 64 bit hash of the formula.
+     */
+    template <typename char_type>
+    inline uint64_t fingerprint(const std::vector<Token>& tokens,
+                                const char_type* formula,
+                                size_t size,
+                                size_t host_row,
+                                size_t host_col)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+
+        for (const auto& token : tokens)
+        {
+            if (token.start() >= size || token.end() >= size)
+                throw invalid_token("Token index out of range");
+
+            hash = _fnv1a(hash, static_cast<uint64_t>(token.type()));
+            hash = _fnv1a(hash, static_cast<uint64_t>(token.subtype()));
+
+            const char_type* value = &formula[token.start()];
+            const size_t length = token.end() + 1 - token.start();
+
+            switch (token.type())
+            {
+                case Token::Type::Operand:
+                    if (token.subtype() == Token::Subtype::Range || token.subtype() == Token::Subtype::Spill)
+                    {
+                        // Relative references are hashed as offsets from the host cell so that
+                        // formulas copied down or across a sheet all have the same fingerprint.
+                        const size_t ref_length = (token.subtype() == Token::Subtype::Spill) ? length - 1 : length;
+                        uint64_t refs_hash = hash;
+                        auto prefix = _for_each_a1_reference(value, ref_length, [&](const _A1Reference& ref) {
+                            // Absent rows and columns (eg. B:B or 1:1) are hashed as 0, as are relative
+                            // offsets of 0, so whether each is present is hashed with the flags
+                            refs_hash = _fnv1a(refs_hash, (ref.abs_row ? 1 : 0) | (ref.abs_col ? 2 : 0)
+                                                        | (ref.row ? 4 : 0) | (ref.col ? 8 : 0));
+                            refs_hash = _fnv1a(refs_hash, (ref.row == 0 || ref.abs_row)
+                                ? ref.row
+                                : static_cast<uint64_t>(static_cast<int64_t>(ref.row) - static_cast<int64_t>(host_row)));
+                            refs_hash = _fnv1a(refs_hash, (ref.col == 0 || ref.abs_col)
+                                ? ref.col
+                                : static_cast<uint64_t>(static_cast<int64_t>(ref.col) - static_cast<int64_t>(host_col)));
+                        });
+
+                        if (prefix >= 0)
+                        {
+                            hash = _fnv1a(refs_hash, value, static_cast<size_t>(prefix), true);
+                            break;
+                        }
+
+                        hash = _fnv1a(hash, value, length, true);
+                        break;
+                    }
+
+                    hash = _fnv1a(hash, value, length,
+                                  token.subtype() == Token::Subtype::Name || token.subtype() == Token::Subtype::Logical);
+                    break;
+
+                case Token::Type::Function:
+                    if (token.subtype() == Token::Subtype::Start)
+                        hash = _fnv1a(hash, value, length, true);
+                    break;
+
+                case Token::Type::OperatorPrefix:
+                case Token::Type::OperatorInfix:
+                case Token::Type::OperatorPostfix:
+                    // Unions and intersections are hashed by subtype only as the
+                    // separator and the amount of whitespace are irrelevant.
+                    if (token.subtype() != Token::Subtype::Union && token.subtype() != Token::Subtype::Intersection)
+                        hash = _fnv1a(hash, value, length, false);
+                    break;
+
+                case Token::Type::Unknown:
+                    hash = _fnv1a(hash, value, length, false);
+                    break;
+
+                default:
+                    // Brackets and separators are fully described by their type and subtype
+                    break;
+            }
+        }
+
+        return hash;
+    }
+
+    /**
+     * Compute a fingerprint identifying the "shape" of an Excel formula.
+     *
+     * Relative A1-style references are normalized to offsets from the host cell,
+     * so a formula copied across a range of cells has the same fingerprint in
+     * every cell (eg. "=A1*2" in B1 and "=A2*2" in B2). Function names, defined
+     * names and references are case insensitive. The result is stable across platforms,
+     * runs and character types.
+     *
+     * @param formula The Excel formula to fingerprint.
+     * @param size Number of characters in the formula string.
+     * @param host_row 1-based row of the cell containing the formula.
+     * @param host_col 1-based column of the cell containing the formula.
+     * @param options Options controlling how the Excel formula is tokenized.
+     * @return 64 bit hash of the formula.
+     */
+    template <typename char_type>
+    inline uint64_t fingerprint(const char_type* formula,
+                                size_t size,
+                                size_t host_row,
+                                size_t host_col,
+                                const Options<char_type>& options)
+    {
+        auto tokens = tokenize(formula, size, options);
+        return fingerprint(tokens, formula, size, host_row, host_col);
+    }
+
+    /**
+     * Compute a fingerprint identifying the "shape" of an Excel formula.
+     *
+     * @param formula The Excel formula to fingerprint.
+     * @param size Number of characters in the formula string.
+     * @param host_row 1-based row of the cell containing the formula.
+     * @param host_col 1-based column of the cell containing the formula.
+     * @return 64 bit hash of the formula.
+     */
+    template <typename char_type>
+    inline uint64_t fingerprint(const char_type* formula, size_t size, size_t host_row, size_t host_col)
+    {
+        return fingerprint(formula, size, host_row, host_col, {});
+    }
+
+   /**
+    * Compute a fingerprint identifying the "shape" of an Excel formula.
+    *
+    * @param formula The Excel formula to fingerprint.
+    * @param host_row 1-based row of the cell containing the formula.
+    * @param host_col 1-based column of the cell containing the formula.
+    * @param options Options controlling how the Excel formula is tokenized.
+    * @return 64 bit hash of the formula.
+    */
+    template<typename string_type>
+    inline uint64_t fingerprint(const string_type& formula,
+                                size_t host_row,
+                                size_t host_col,
+                                const Options<typename string_type::value_type>& options)
+    {
+        return fingerprint(formula.data(), formula.size(), host_row, host_col, options);
+    }
+
+   /**
+    * Compute a fingerprint identifying the "shape" of an Excel formula.
+    *
+    * @param formula The Excel formula to fingerprint.
+    * @param host_row 1-based row of the cell containing the formula.
+    * @param host_col 1-based column of the cell containing the formula.
+    * @return 64 bit hash of the formula.
+    */
+    template<typename string_type>
+    inline uint64_t fingerprint(const string_type& formula, size_t host_row, size_t host_col)
+    {
+        return fingerprint(formula.data(), formula.size(), host_row, host_col, {});
+    }
 }
 
 
@@ -0,0 +1,310 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef _XLFPARSER_ARROW_H_
+#define _XLFPARSER_ARROW_H_
+
+#include "xlfparser.h"
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+// Structs defined by the Arrow C Data Interface, see
+// https://arrow.apache.org/docs/format/CDataInterface.html
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C" {
+
+struct ArrowSchema {
+    // Array type description
+    const char* format;
+    const char* name;
+    const char* metadata;
+    int64_t flags;
+    int64_t n_children;
+    struct ArrowSchema** children;
+    struct ArrowSchema* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowSchema*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+struct ArrowArray {
+    // Array data description
+    int64_t length;
+    int64_t null_count;
+    int64_t offset;
+    int64_t n_buffers;
+    int64_t n_children;
+    const void** buffers;
+    struct ArrowArray** children;
+    struct ArrowArray* dictionary;
+
+    // Release callback
+    void (*release)(struct ArrowArray*);
+    // Opaque producer-specific data
+    void* private_data;
+};
+
+}
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+
+namespace xlfparser {
+
+    /*
+     * Storage for exported Arrow arrays and schemas.
+     *
+     * Every exported struct (including children and dictionaries) keeps the storage alive
+     * through its own shared pointer, so consumers can move children out and release them
+     * independently of their parent, as required by the C Data Interface.
+     */
+    struct _ArrowExport
+    {
+        enum { FORMULA_ID, START, END, TYPE, SUBTYPE, VALUE, NUM_COLUMNS };
+
+        struct Arrays
+        {
+            std::vector<int64_t> formula_id;
+            std::vector<int64_t> start;
+            std::vector<int64_t> end;
+            std::vector<uint8_t> type;
+            std::vector<uint8_t> subtype;
+            std::vector<int32_t> value;
+            std::vector<int32_t> dictionary_offsets;
+            std::string dictionary_data;
+
+            ArrowArray columns[NUM_COLUMNS];
+            ArrowArray* column_ptrs[NUM_COLUMNS];
+            ArrowArray dictionary;
+            const void* buffers[NUM_COLUMNS + 2][3];
+        };
+
+        struct Schemas
+        {
+            ArrowSchema columns[NUM_COLUMNS];
+            ArrowSchema* column_ptrs[NUM_COLUMNS];
+            ArrowSchema dictionary;
+        };
+
+        template <typename struct_type, typename storage_type>
+        static void release(struct_type* s)
+        {
+            for (int64_t i = 0; i < s->n_children; ++i)
+                if (s->children[i]->release != nullptr)
+                    s->children[i]->release(s->children[i]);
+
+            if (s->dictionary != nullptr && s->dictionary->release != nullptr)
+                s->dictionary->release(s->dictionary);
+
+            delete static_cast<std::shared_ptr<storage_type>*>(s->private_data);
+            s->release = nullptr;
+        }
+
+        static void init(ArrowArray& array,
+                         const std::shared_ptr<Arrays>& arrays,
+                         int64_t length,
+                         const void** buffers,
+                         int64_t n_buffers)
+        {
+            array.length = length;
+            array.null_count = 0;
+            array.offset = 0;
+            array.n_buffers = n_buffers;
+            array.n_children = 0;
+            array.buffers = buffers;
+            array.children = nullptr;
+            array.dictionary = nullptr;
+            array.release = &release<ArrowArray, Arrays>;
+            array.private_data = new std::shared_ptr<Arrays>(arrays);
+        }
+
+        static void init(ArrowSchema& schema, const std::shared_ptr<Schemas>& schemas, const char* format, const char* name)
+        {
+            schema.format = format;
+            schema.name = name;
+            schema.metadata = nullptr;
+            schema.flags = 0;
+            schema.n_children = 0;
+            schema.children = nullptr;
+            schema.dictionary = nullptr;
+            schema.release = &release<ArrowSchema, Schemas>;
+            schema.private_data = new std::shared_ptr<Schemas>(schemas);
+        }
+    };
+
+    /**
+     * Export a batch of tokenized formulas as an Arrow table, using the Arrow C Data Interface.
+     *
+     * The table is exported as a struct array with one row per token and these columns:
+     *
+     *     formula_id  int64   index of the formula in the batch
+     *     start       int64   index of the first character of the token in the formula
+     *     end         int64   index of the last character of the token in the formula
+     *     type        uint8   Token::Type
+     *     subtype     uint8   Token::Subtype
+     *     value       dictionary<int32, utf8>   token text
+     *
+     * The columns are built once and ownership of them passes to the consumer, who must call
+     * the release callbacks of the schema and array once it's finished with them.
+     *
+     * @param batch Tokens for the formulas, as returned by tokenize_batch.
+     * @param formulas The formulas the batch was created from.
+     * @param schema Schema to initialize.
+     * @param array Array to initialize.
+     */
+    inline void export_arrow(const TokenBatch& batch,
+                             const std::string_view* formulas,
+                             ArrowSchema* schema,
+                             ArrowArray* array)
+    {
+        const size_t num_tokens = batch.tokens.size();
+        if (num_tokens > size_t(std::numeric_limits<int64_t>::max()))
+            throw std::length_error("Too many tokens to export");
+
+        auto arrays = std::make_shared<_ArrowExport::Arrays>();
+        arrays->formula_id.reserve(num_tokens);
+        arrays->start.reserve(num_tokens);
+        arrays->end.reserve(num_tokens);
+        arrays->type.reserve(num_tokens);
+        arrays->subtype.reserve(num_tokens);
+        arrays->value.reserve(num_tokens);
+        arrays->dictionary_offsets.push_back(0);
+
+        // Token values are deduplicated into the dictionary
+        std::unordered_map<std::string_view, int32_t> dictionary;
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const std::string_view formula = formulas[i];
+            for (const Token& token : batch[i])
+            {
+                if (token.end() >= formula.size() || token.start() > token.end())
+                    throw invalid_token("Token index out of range");
+
+                arrays->formula_id.push_back(int64_t(i));
+                arrays->start.push_back(int64_t(token.start()));
+                arrays->end.push_back(int64_t(token.end()));
+                arrays->type.push_back(uint8_t(token.type()));
+                arrays->subtype.push_back(uint8_t(token.subtype()));
+
+                const std::string_view value = formula.substr(token.start(), token.end() + 1 - token.start());
+                auto inserted = dictionary.emplace(value, int32_t(dictionary.size()));
+                if (inserted.second)
+                {
+                    if (arrays->dictionary_data.size() + value.size() > size_t(std::numeric_limits<int32_t>::max()))
+                        throw std::length_error("Too many token values to export");
+
+                    arrays->dictionary_data.append(value.data(), value.size());
+                    arrays->dictionary_offsets.push_back(int32_t(arrays->dictionary_data.size()));
+                }
+
+                arrays->value.push_back(inserted.first->second);
+            }
+        }
+
+        const int64_t length = int64_t(num_tokens);
+        const void* data[_ArrowExport::NUM_COLUMNS] = {
+            arrays->formula_id.data(),
+            arrays->start.data(),
+            arrays->end.data(),
+            arrays->type.data(),
+            arrays->subtype.data(),
+            arrays->value.data()
+        };
+
+        for (int c = 0; c < _ArrowExport::NUM_COLUMNS; ++c)
+        {
+            arrays->buffers[c][0] = nullptr;  // no validity bitmap as there are no nulls
+            arrays->buffers[c][1] = data[c];
+            _ArrowExport::init(arrays->columns[c], arrays, length, arrays->buffers[c], 2);
+            arrays->column_ptrs[c] = &arrays->columns[c];
+        }
+
+        const void** dictionary_buffers = arrays->buffers[_ArrowExport::NUM_COLUMNS];
+        dictionary_buffers[0] = nullptr;
+        dictionary_buffers[1] = arrays->dictionary_offsets.data();
+        dictionary_buffers[2] = arrays->dictionary_data.data();
+        _ArrowExport::init(arrays->dictionary, arrays, int64_t(dictionary.size()), dictionary_buffers, 3);
+        arrays->columns[_ArrowExport::VALUE].dictionary = &arrays->dictionary;
+
+        const void** struct_buffers = arrays->buffers[_ArrowExport::NUM_COLUMNS + 1];
+        struct_buffers[0] = nullptr;
+        _ArrowExport::init(*array, arrays, length, struct_buffers, 1);
+        array->n_children = _ArrowExport::NUM_COLUMNS;
+        array->children = arrays->column_ptrs;
+
+        // The schema is independent of the array so each can be released separately
+        auto schemas = std::make_shared<_ArrowExport::Schemas>();
+        const char* formats[_ArrowExport::NUM_COLUMNS] = {"l", "l", "l", "C", "C", "i"};
+        const char* names[_ArrowExport::NUM_COLUMNS] = {"formula_id", "start", "end", "type", "subtype", "value"};
+
+        for (int c = 0; c < _ArrowExport::NUM_COLUMNS; ++c)
+        {
+            _ArrowExport::init(schemas->columns[c], schemas, formats[c], names[c]);
+            schemas->column_ptrs[c] = &schemas->columns[c];
+        }
+
+        _ArrowExport::init(schemas->dictionary, schemas, "u", nullptr);
+        schemas->columns[_ArrowExport::VALUE].dictionary = &schemas->dictionary;
+
+        _ArrowExport::init(*schema, schemas, "+s", nullptr);
+        schema->n_children = _ArrowExport::NUM_COLUMNS;
+        schema->children = schemas->column_ptrs;
+    }
+
+    /**
+     * Export a batch of tokenized formulas as an Arrow table, using the Arrow C Data Interface.
+     * See export_arrow(batch, formulas, schema, array).
+     *
+     * @param batch Tokens for the formulas, as returned by tokenize_batch.
+     * @param formulas Container of the formulas the batch was created from.
+     * @param schema Schema to initialize.
+     * @param array Array to initialize.
+     */
+    template <typename range_type, typename = typename range_type::value_type>
+    inline void export_arrow(const TokenBatch& batch, const range_type& formulas, ArrowSchema* schema, ArrowArray* array)
+    {
+        std::vector<std::string_view> views(std::begin(formulas), std::end(formulas));
+        if (views.size() != batch.size())
+            throw std::invalid_argument("Number of formulas doesn't match the batch");
+
+        export_arrow(batch, views.data(), schema, array);
+    }
+}
+
+
+#endif // _XLFPARSER_ARROW_H_
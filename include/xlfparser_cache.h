@@ -0,0 +1,343 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef _XLFPARSER_CACHE_H_
+#define _XLFPARSER_CACHE_H_
+
+#include "xlfparser.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+namespace xlfparser {
+
+    /**
+     * Thread-safe cache of tokenized formulas, keyed by the formula and the tokenize options.
+     *
+     * The cache is split into shards, each with its own reader/writer lock, so lookups
+     * from many threads rarely contend. Each shard is bounded to an equal share of the
+     * capacity (in bytes) and evicts entries using the CLOCK algorithm, which lets hits
+     * be served under a shared lock.
+     *
+     * Cached token vectors are immutable and shared, so they remain valid after being
+     * evicted for as long as the caller holds on to them.
+     */
+    template <typename char_type>
+    class TokenCache
+    {
+    public:
+        typedef std::shared_ptr<const std::vector<Token>> tokens_type;
+
+        struct Stats
+        {
+            size_t hits;
+            size_t misses;
+            size_t evictions;
+            size_t entries;
+            size_t bytes;
+        };
+
+        /**
+         * @param capacity Maximum size of the cache in bytes.
+         * @param shards Number of independently locked shards (rounded up to a power of 2, and
+         *               reduced for small capacities so each shard can hold several formulas).
+         */
+        explicit TokenCache(size_t capacity, size_t shards = 64)
+            : m_capacity(capacity)
+        {
+            m_num_shards = 1;
+            while (m_num_shards < shards)
+                m_num_shards <<= 1;
+
+            while (m_num_shards > 1 && capacity / m_num_shards < min_shard_capacity)
+                m_num_shards >>= 1;
+
+            m_shards.reset(new Shard[m_num_shards]);
+            m_shard_capacity = capacity / m_num_shards;
+        }
+
+        TokenCache(const TokenCache&) = delete;
+        TokenCache& operator=(const TokenCache&) = delete;
+
+        /**
+         * Get the tokens for an Excel formula, tokenizing it if it's not already cached.
+         *
+         * @param formula The Excel formula to tokenize.
+         * @param size Number of characters in the formula string.
+         * @param options Options controlling how the Excel formula is tokenized.
+         * @return Shared vector of tokens.
+         */
+        tokens_type tokenize(const char_type* formula, size_t size, const Options<char_type>& options)
+        {
+            if (nullptr == formula)
+                throw invalid_formula("null formula pointer");
+
+            const Key key = make_key(formula, size, options);
+            Shard& shard = m_shards[(key.hash >> 7) & (m_num_shards - 1)];
+
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                auto iter = shard.index.find(key);
+                if (iter != shard.index.end())
+                {
+                    const auto& entry = shard.clock[iter->second];
+                    entry->referenced.store(true, std::memory_order_relaxed);
+                    shard.hits.fetch_add(1, std::memory_order_relaxed);
+                    return entry->tokens;
+                }
+            }
+
+            shard.misses.fetch_add(1, std::memory_order_relaxed);
+
+            // Tokenize without holding the lock, invalid formulas throw and are not cached
+            tokens_type tokens = std::make_shared<const std::vector<Token>>(
+                xlfparser::tokenize(formula, size, options));
+
+            insert(shard, key, tokens);
+            return tokens;
+        }
+
+        /**
+         * Get the tokens for an Excel formula, tokenizing it if it's not already cached.
+         *
+         * @param formula The Excel formula to tokenize.
+         * @param size Number of characters in the formula string.
+         * @return Shared vector of tokens.
+         */
+        tokens_type tokenize(const char_type* formula, size_t size)
+        {
+            return tokenize(formula, size, {});
+        }
+
+        /**
+         * Get the tokens for an Excel formula, tokenizing it if it's not already cached.
+         *
+         * @param formula The Excel formula to tokenize.
+         * @param options Options controlling how the Excel formula is tokenized.
+         * @return Shared vector of tokens.
+         */
+        tokens_type tokenize(std::basic_string_view<char_type> formula, const Options<char_type>& options)
+        {
+            return tokenize(formula.data(), formula.size(), options);
+        }
+
+        /**
+         * Get the tokens for an Excel formula, tokenizing it if it's not already cached.
+         *
+         * @param formula The Excel formula to tokenize.
+         * @return Shared vector of tokens.
+         */
+        tokens_type tokenize(std::basic_string_view<char_type> formula)
+        {
+            return tokenize(formula.data(), formula.size(), {});
+        }
+
+        /* Remove all entries from the cache. The counters are not reset. */
+        void clear()
+        {
+            for (size_t i = 0; i < m_num_shards; ++i)
+            {
+                Shard& shard = m_shards[i];
+                std::unique_lock<std::shared_mutex> lock(shard.mutex);
+                shard.index.clear();
+                shard.clock.clear();
+                shard.hand = 0;
+                shard.bytes = 0;
+            }
+        }
+
+        /* Get the hit, miss and eviction counters and the current size of the cache. */
+        Stats stats() const
+        {
+            Stats stats = {0, 0, 0, 0, 0};
+            for (size_t i = 0; i < m_num_shards; ++i)
+            {
+                const Shard& shard = m_shards[i];
+                stats.hits += shard.hits.load(std::memory_order_relaxed);
+                stats.misses += shard.misses.load(std::memory_order_relaxed);
+                stats.evictions += shard.evictions.load(std::memory_order_relaxed);
+
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                stats.entries += shard.clock.size();
+                stats.bytes += shard.bytes;
+            }
+            return stats;
+        }
+
+        size_t capacity() const { return m_capacity; }
+
+    private:
+        typedef std::array<char_type, 8> options_type;
+
+        // A typical formula takes a few hundred bytes to cache
+        static constexpr size_t min_shard_capacity = 4096;
+
+        // Lookup key, the formula points into the entry once cached. The formula is a pointer
+        // and size rather than a string view, as std::char_traits is only standard for the
+        // character types and not for the unsigned integer types tokenize also accepts.
+        struct Key
+        {
+            const char_type* formula;
+            size_t size;
+            options_type options;
+            size_t hash;
+
+            bool operator==(const Key& other) const
+            {
+                return hash == other.hash
+                    && options == other.options
+                    && size == other.size
+                    && std::equal(formula, formula + size, other.formula);
+            }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const { return key.hash; }
+        };
+
+        struct Entry
+        {
+            std::vector<char_type> formula;
+            options_type options;
+            size_t hash;
+            size_t bytes;
+            tokens_type tokens;
+            mutable std::atomic<bool> referenced;
+
+            Key key() const { return {formula.data(), formula.size(), options, hash}; }
+        };
+
+        struct alignas(64) Shard
+        {
+            mutable std::shared_mutex mutex;
+            std::unordered_map<Key, size_t, KeyHash> index;  // key -> position in clock
+            std::vector<std::unique_ptr<Entry>> clock;
+            size_t hand = 0;
+            size_t bytes = 0;
+            std::atomic<size_t> hits{0};
+            std::atomic<size_t> misses{0};
+            std::atomic<size_t> evictions{0};
+        };
+
+        static Key make_key(const char_type* formula, size_t size, const Options<char_type>& options)
+        {
+            const options_type resolved = {
+                options.left_brace.value_or(XLFP_CHAR('{')),
+                options.right_brace.value_or(XLFP_CHAR('}')),
+                options.left_bracket.value_or(XLFP_CHAR('[')),
+                options.right_bracket.value_or(XLFP_CHAR(']')),
+                options.list_separator.value_or(XLFP_CHAR(',')),
+                options.decimal_separator.value_or(XLFP_CHAR('.')),
+                options.row_separator.value_or(XLFP_CHAR(';')),
+                static_cast<char_type>(options.leading_equals)
+            };
+
+            // std::hash is only specialized for the standard character types
+            uint64_t hash = _fnv1a(14695981039346656037ULL, formula, size, false);
+            for (auto c : resolved)
+                hash = _fnv1a(hash, static_cast<uint64_t>(c));
+
+            return {formula, size, resolved, static_cast<size_t>(hash)};
+        }
+
+        void insert(Shard& shard, const Key& key, const tokens_type& tokens)
+        {
+            const size_t bytes = sizeof(Entry)
+                               + key.size * sizeof(char_type)
+                               + tokens->capacity() * sizeof(Token);
+
+            if (bytes > m_shard_capacity)
+                return;
+
+            std::unique_ptr<Entry> entry(new Entry{
+                std::vector<char_type>(key.formula, key.formula + key.size),
+                key.options,
+                key.hash,
+                bytes,
+                tokens,
+                {false}
+            });
+
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+            // Another thread may have cached the same formula while this one was tokenizing it
+            if (shard.index.find(key) != shard.index.end())
+                return;
+
+            while (shard.bytes + bytes > m_shard_capacity)
+                evict(shard);
+
+            shard.index.emplace(entry->key(), shard.clock.size());
+            shard.bytes += bytes;
+            shard.clock.push_back(std::move(entry));
+        }
+
+        // Evict one entry, skipping over (and clearing) any that have been used recently.
+        // Must be called with the shard's lock held exclusively.
+        void evict(Shard& shard)
+        {
+            while (true)
+            {
+                if (shard.hand >= shard.clock.size())
+                    shard.hand = 0;
+
+                auto& entry = shard.clock[shard.hand];
+                if (entry->referenced.exchange(false, std::memory_order_relaxed))
+                {
+                    ++shard.hand;
+                    continue;
+                }
+
+                shard.index.erase(entry->key());
+                shard.bytes -= entry->bytes;
+
+                // Fill the gap with the last entry so the clock stays dense
+                if (shard.hand + 1 != shard.clock.size())
+                {
+                    entry = std::move(shard.clock.back());
+                    shard.index.find(entry->key())->second = shard.hand;
+                }
+
+                shard.clock.pop_back();
+                shard.evictions.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        size_t m_capacity;
+        size_t m_shard_capacity;
+        size_t m_num_shards;
+        std::unique_ptr<Shard[]> m_shards;
+    };
+}
+
+
+#endif // _XLFPARSER_CACHE_H_
@@ -0,0 +1,360 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef _XLFPARSER_CORPUS_H_
+#define _XLFPARSER_CORPUS_H_
+
+#include "xlfparser.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace xlfparser {
+
+    /**
+     * Read-only memory mapping of a whole file.
+     *
+     * Throws std::system_error if the file can't be opened or mapped.
+     */
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+
+        /**
+         * @param path Path of the file to map.
+         */
+        explicit MappedFile(const std::string& path)
+        {
+#ifdef _WIN32
+            HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+            if (file == INVALID_HANDLE_VALUE)
+                throw std::system_error(GetLastError(), std::system_category(), "Unable to open " + path);
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file, &size))
+            {
+                const DWORD error = GetLastError();
+                CloseHandle(file);
+                throw std::system_error(error, std::system_category(), "Unable to get the size of " + path);
+            }
+
+            m_size = static_cast<size_t>(size.QuadPart);
+            if (m_size > 0)
+            {
+                HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                const DWORD error = GetLastError();
+                CloseHandle(file);
+                if (mapping == NULL)
+                    throw std::system_error(error, std::system_category(), "Unable to map " + path);
+
+                m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                const DWORD view_error = GetLastError();
+                CloseHandle(mapping);
+                if (m_data == nullptr)
+                    throw std::system_error(view_error, std::system_category(), "Unable to map " + path);
+            }
+            else
+            {
+                CloseHandle(file);
+            }
+#else
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "Unable to open " + path);
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0)
+            {
+                const int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "Unable to get the size of " + path);
+            }
+
+            // Empty files can't be mapped, but there's nothing to map anyway
+            m_size = static_cast<size_t>(st.st_size);
+            if (m_size > 0)
+            {
+                void* data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+                const int error = errno;
+                ::close(fd);
+                if (data == MAP_FAILED)
+                    throw std::system_error(error, std::generic_category(), "Unable to map " + path);
+
+                m_data = static_cast<const char*>(data);
+            }
+            else
+            {
+                ::close(fd);
+            }
+#endif
+        }
+
+        ~MappedFile() { unmap(); }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        MappedFile(MappedFile&& other) noexcept
+            : m_data(other.m_data), m_size(other.m_size)
+        {
+            other.m_data = nullptr;
+            other.m_size = 0;
+        }
+
+        MappedFile& operator=(MappedFile&& other) noexcept
+        {
+            if (this != &other)
+            {
+                unmap();
+                m_data = other.m_data;
+                m_size = other.m_size;
+                other.m_data = nullptr;
+                other.m_size = 0;
+            }
+            return *this;
+        }
+
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        void unmap()
+        {
+            if (m_data == nullptr)
+                return;
+#ifdef _WIN32
+            UnmapViewOfFile(m_data);
+#else
+            ::munmap(const_cast<char*>(m_data), m_size);
+#endif
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+        const char* m_data = nullptr;
+        size_t m_size = 0;
+    };
+
+    /**
+     * Memory mapped file of Excel formulas separated by a delimiter character.
+     *
+     * The formulas are returned as string views into the mapping. They can be iterated
+     * over directly and passed to tokenize_batch without copying them. A trailing
+     * delimiter at the end of the file is optional and, for newline delimited files,
+     * a carriage return before the newline is not included in the formula.
+     *
+     * Random access to the formulas needs an index file, which is a list of the offsets
+     * of the start of each formula in the file as 64 bit little endian integers. See also
+     * write_index.
+     */
+    class MappedCorpus
+    {
+    public:
+        typedef std::string_view value_type;
+
+        class const_iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef std::string_view value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const std::string_view* pointer;
+            typedef std::string_view reference;
+
+            const_iterator() = default;
+
+            std::string_view operator*() const { return _trim(m_pos, m_next, m_delimiter); }
+
+            const_iterator& operator++()
+            {
+                m_pos = m_next == m_end ? m_end : m_next + 1;
+                m_next = _find(m_pos, m_end, m_delimiter);
+                return *this;
+            }
+
+            const_iterator operator++(int)
+            {
+                const_iterator previous = *this;
+                ++*this;
+                return previous;
+            }
+
+            bool operator==(const const_iterator& other) const { return m_pos == other.m_pos; }
+            bool operator!=(const const_iterator& other) const { return m_pos != other.m_pos; }
+
+        private:
+            friend class MappedCorpus;
+
+            const_iterator(const char* pos, const char* end, char delimiter)
+                : m_pos(pos), m_next(_find(pos, end, delimiter)), m_end(end), m_delimiter(delimiter) {}
+
+            const char* m_pos = nullptr;  // start of the current formula
+            const char* m_next = nullptr;  // delimiter after the current formula, or m_end
+            const char* m_end = nullptr;
+            char m_delimiter = '\n';
+        };
+
+        /**
+         * @param path Path of the file of formulas.
+         * @param delimiter Character separating the formulas, usually '\n' or '\0'.
+         */
+        explicit MappedCorpus(const std::string& path, char delimiter = '\n')
+            : m_file(path), m_delimiter(delimiter)
+        {
+        }
+
+        /**
+         * @param path Path of the file of formulas.
+         * @param index_path Path of the index file for the formulas.
+         * @param delimiter Character separating the formulas, usually '\n' or '\0'.
+         */
+        MappedCorpus(const std::string& path, const std::string& index_path, char delimiter = '\n')
+            : m_file(path), m_index(index_path), m_delimiter(delimiter), m_has_index(true)
+        {
+            if (m_index.size() % sizeof(uint64_t) != 0)
+                throw std::runtime_error("Invalid corpus index file " + index_path);
+        }
+
+        const_iterator begin() const { return const_iterator(m_file.data(), m_file.data() + m_file.size(), m_delimiter); }
+        const_iterator end() const { return const_iterator(m_file.data() + m_file.size(), m_file.data() + m_file.size(), m_delimiter); }
+
+        /* True if the corpus was opened with an index file. */
+        bool has_index() const { return m_has_index; }
+
+        /* Number of formulas in the index. */
+        size_t size() const { return m_index.size() / sizeof(uint64_t); }
+
+        /**
+         * Get a formula from the corpus using the index.
+         *
+         * @param i Index of the formula, from 0 to size().
+         * @return The formula.
+         */
+        std::string_view operator[](size_t i) const
+        {
+            if (i >= size())
+                throw std::out_of_range("Formula index out of range");
+
+            const char* data = m_file.data();
+            const size_t start = offset(i);
+            size_t end = (i + 1 < size()) ? offset(i + 1) : m_file.size();
+
+            if (start > m_file.size() || end > m_file.size() || start > end)
+                throw std::out_of_range("Corpus index doesn't match the file");
+
+            // The next formula starts after the delimiter
+            if (end > start && (i + 1 < size() || data[end - 1] == m_delimiter))
+                --end;
+
+            return _trim(data + start, data + end, m_delimiter);
+        }
+
+        /* The whole mapped file. */
+        std::string_view data() const { return std::string_view(m_file.data(), m_file.size()); }
+
+        /**
+         * Write an index file for a file of formulas.
+         *
+         * @param path Path of the file of formulas.
+         * @param index_path Path of the index file to write.
+         * @param delimiter Character separating the formulas, usually '\n' or '\0'.
+         * @return The number of formulas in the index.
+         */
+        static size_t write_index(const std::string& path, const std::string& index_path, char delimiter = '\n')
+        {
+            MappedCorpus corpus(path, delimiter);
+
+            std::ofstream index(index_path, std::ios::binary | std::ios::trunc);
+            if (!index)
+                throw std::system_error(errno, std::generic_category(), "Unable to open " + index_path);
+
+            size_t count = 0;
+            for (auto iter = corpus.begin(); iter != corpus.end(); ++iter, ++count)
+            {
+                uint64_t offset = static_cast<uint64_t>(iter.m_pos - corpus.m_file.data());
+                unsigned char bytes[sizeof(uint64_t)];
+                for (size_t i = 0; i < sizeof(bytes); ++i, offset >>= 8)
+                    bytes[i] = static_cast<unsigned char>(offset & 0xff);
+                index.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+            }
+
+            if (!index.flush())
+                throw std::system_error(errno, std::generic_category(), "Unable to write " + index_path);
+
+            return count;
+        }
+
+    private:
+        static const char* _find(const char* pos, const char* end, char delimiter)
+        {
+            if (pos == end)
+                return end;
+            const void* found = std::memchr(pos, delimiter, static_cast<size_t>(end - pos));
+            return found ? static_cast<const char*>(found) : end;
+        }
+
+        static std::string_view _trim(const char* first, const char* last, char delimiter)
+        {
+            if (delimiter == '\n' && last > first && *(last - 1) == '\r')
+                --last;
+            return std::string_view(first, static_cast<size_t>(last - first));
+        }
+
+        size_t offset(size_t i) const
+        {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(m_index.data()) + i * sizeof(uint64_t);
+            uint64_t offset = 0;
+            for (size_t j = sizeof(uint64_t); j > 0; --j)
+                offset = (offset << 8) | bytes[j - 1];
+            return static_cast<size_t>(offset);
+        }
+
+        MappedFile m_file;
+        MappedFile m_index;
+        char m_delimiter;
+        bool m_has_index = false;
+    };
+}
+
+
+#endif // _XLFPARSER_CORPUS_H_
@@ -0,0 +1,678 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef _XLFPARSER_GENERATOR_H_
+#define _XLFPARSER_GENERATOR_H_
+
+#include "xlfparser.h"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace xlfparser {
+
+    /**
+     * A function that may be used in generated formulas.
+     */
+    struct GeneratorFunction
+    {
+        std::string name;
+        unsigned min_arguments;
+        unsigned max_arguments;
+        unsigned weight;  // relative to the other functions
+    };
+
+    /**
+     * Options controlling the formulas created by FormulaGenerator.
+     *
+     * Weights are relative to the other weights in the same group, and a weight of 0
+     * disables that choice. At least one weight in each group must be non-zero.
+     */
+    struct GeneratorOptions
+    {
+        // Seed for the random number generator. The same seed and options always produce the same formulas.
+        uint64_t seed = 0;
+
+        // Approximate range of formula lengths in characters, chosen so that short formulas are the most common.
+        // Formulas are usually a little longer than the chosen length as the last operand isn't truncated.
+        size_t min_length = 8;
+        size_t max_length = 256;
+
+        // Maximum nesting depth of function calls and parentheses.
+        size_t max_depth = 4;
+
+        // Maximum length of the text in string literals, not including the quotes.
+        size_t max_string_length = 24;
+
+        // Maximum number of rows and columns in array literals.
+        size_t max_array_rows = 4;
+        size_t max_array_columns = 4;
+
+        // Weights of the kinds of operand.
+        unsigned reference_weight = 12;
+        unsigned function_weight = 8;
+        unsigned number_weight = 6;
+        unsigned string_weight = 2;
+        unsigned logical_weight = 1;
+        unsigned error_weight = 1;
+        unsigned array_weight = 1;
+        unsigned subexpression_weight = 2;
+
+        // Weights of the reference styles: A1 (Sheet1!$A$1:B2), R1C1 (R[-1]C2), external
+        // ([Book1.xlsx]Sheet1!A1) and structured (Table1[[#This Row],[Amount]]).
+        unsigned a1_weight = 10;
+        unsigned r1c1_weight = 0;
+        unsigned external_weight = 1;
+        unsigned structured_weight = 1;
+
+        // Functions to call and their weights. If empty, a mix of common worksheet functions is used.
+        std::vector<GeneratorFunction> functions;
+
+        // Separators, braces and brackets to use and whether formulas start with '='.
+        // Tokenize the generated formulas with the same options.
+        Options<char> format;
+    };
+
+    /**
+     * Generates random but reproducible Excel formulas, for benchmarks and tests that need large
+     * volumes of realistic formulas.
+     *
+     * Each formula is determined only by the options and its index, so a corpus of any size can be
+     * generated in any order, or split between threads, and is the same on every platform.
+     * Generated formulas are ASCII only, never contain newlines and are valid for tokenize.
+     *
+     * Example:
+     *
+     *     GeneratorOptions options;
+     *     options.seed = 42;
+     *     FormulaGenerator generator(options);
+     *
+     *     std::string formula;
+     *     for (uint64_t i = 0; i < count; ++i)
+     *     {
+     *         generator.generate(i, formula);
+     *         ...
+     *     }
+     */
+    class FormulaGenerator
+    {
+    public:
+        explicit FormulaGenerator(const GeneratorOptions& options = GeneratorOptions())
+            : m_options(options)
+        {
+            if (m_options.functions.empty())
+                m_options.functions = default_functions();
+
+            if (m_options.max_length < m_options.min_length)
+                m_options.max_length = m_options.min_length;
+
+            const auto& format = m_options.format;
+            m_left_brace = format.left_brace.value_or('{');
+            m_right_brace = format.right_brace.value_or('}');
+            m_left_bracket = format.left_bracket.value_or('[');
+            m_right_bracket = format.right_bracket.value_or(']');
+            m_list_separator = format.list_separator.value_or(',');
+            m_decimal_separator = format.decimal_separator.value_or('.');
+            m_row_separator = format.row_separator.value_or(';');
+        }
+
+        const GeneratorOptions& options() const
+        {
+            return m_options;
+        }
+
+        /**
+         * Generate the formula with the given index.
+         *
+         * @param index Index of the formula.
+         * @param formula String to write the formula to. Its contents are replaced.
+         */
+        void generate(uint64_t index, std::string& formula) const
+        {
+            Random random(m_options.seed, index);
+
+            formula.clear();
+            if (m_options.format.leading_equals)
+                formula.push_back('=');
+
+            const size_t target = formula.size() + random_length(random);
+
+            expression(random, 0, formula);
+            while (formula.size() < target)
+            {
+                infix_operator(random, formula);
+                term(random, 0, formula);
+            }
+        }
+
+        /**
+         * Generate the formula with the given index.
+         *
+         * @param index Index of the formula.
+         * @return The formula.
+         */
+        std::string operator()(uint64_t index) const
+        {
+            std::string formula;
+            generate(index, formula);
+            return formula;
+        }
+
+        /**
+         * The functions used when GeneratorOptions::functions is empty.
+         */
+        static std::vector<GeneratorFunction> default_functions()
+        {
+            return {
+                {"SUM", 1, 4, 20},
+                {"IF", 3, 3, 16},
+                {"VLOOKUP", 4, 4, 8},
+                {"INDEX", 2, 3, 6},
+                {"MATCH", 3, 3, 6},
+                {"SUMIFS", 3, 7, 5},
+                {"IFERROR", 2, 2, 5},
+                {"ROUND", 2, 2, 5},
+                {"AND", 2, 4, 4},
+                {"OR", 2, 4, 3},
+                {"MAX", 1, 4, 4},
+                {"MIN", 1, 4, 4},
+                {"AVERAGE", 1, 3, 3},
+                {"COUNTIF", 2, 2, 3},
+                {"OFFSET", 3, 5, 2},
+                {"TEXT", 2, 2, 2},
+                {"LEFT", 2, 2, 2},
+                {"CONCATENATE", 2, 5, 2},
+                {"DATE", 3, 3, 2},
+                {"XLOOKUP", 3, 6, 2},
+                {"TODAY", 0, 0, 1},
+                {"NOW", 0, 0, 1}
+            };
+        }
+
+    private:
+        // SplitMix64, seeded from the seed and formula index so formulas can be generated independently
+        struct Random
+        {
+            uint64_t state;
+
+            Random(uint64_t seed, uint64_t index)
+                : state(seed)
+            {
+                state = next() ^ index;
+                next();
+            }
+
+            uint64_t next()
+            {
+                uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+                return z ^ (z >> 31);
+            }
+
+            // Uniform in [0, n)
+            uint64_t below(uint64_t n)
+            {
+                return n ? next() % n : 0;
+            }
+
+            // Uniform in [first, last]
+            uint64_t between(uint64_t first, uint64_t last)
+            {
+                return first + below(last - first + 1);
+            }
+
+            bool chance(unsigned percent)
+            {
+                return below(100) < percent;
+            }
+
+            // Index of an entry chosen with probability proportional to its weight
+            size_t weighted(const unsigned* weights, size_t count)
+            {
+                uint64_t total = 0;
+                for (size_t i = 0; i < count; ++i)
+                    total += weights[i];
+
+                uint64_t choice = below(total);
+                for (size_t i = 0; i < count; ++i)
+                {
+                    if (choice < weights[i])
+                        return i;
+                    choice -= weights[i];
+                }
+                return 0;
+            }
+        };
+
+        // Length chosen uniformly within a uniformly chosen power of two range, so short formulas are common
+        size_t random_length(Random& random) const
+        {
+            const size_t min_length = m_options.min_length;
+            const size_t max_length = m_options.max_length;
+
+            size_t low = 0;
+            size_t high = 0;
+            while ((size_t(1) << high) < max_length && high < 62)
+                ++high;
+            while ((size_t(1) << (low + 1)) <= min_length && low < high)
+                ++low;
+
+            const size_t bits = size_t(random.between(low, high));
+            const size_t first = std::max(min_length, size_t(1) << bits);
+            const size_t last = std::min(max_length, (size_t(1) << (bits + 1)) - 1);
+            return first <= last ? size_t(random.between(first, last)) : first;
+        }
+
+        // One or more terms joined by operators
+        void expression(Random& random, size_t depth, std::string& out) const
+        {
+            term(random, depth, out);
+            while (random.chance(25))
+            {
+                infix_operator(random, out);
+                term(random, depth, out);
+            }
+        }
+
+        void term(Random& random, size_t depth, std::string& out) const
+        {
+            enum { REFERENCE, FUNCTION, NUMBER, STRING, LOGICAL, ERROR, ARRAY, SUBEXPRESSION, NUM_KINDS };
+            unsigned weights[NUM_KINDS] = {
+                m_options.reference_weight,
+                m_options.function_weight,
+                m_options.number_weight,
+                m_options.string_weight,
+                m_options.logical_weight,
+                m_options.error_weight,
+                m_options.array_weight,
+                m_options.subexpression_weight
+            };
+
+            // Only operands are allowed at the maximum depth
+            if (depth >= m_options.max_depth)
+                weights[FUNCTION] = weights[SUBEXPRESSION] = 0;
+
+            if (random.chance(5))
+                out.push_back('-');
+
+            switch (random.weighted(weights, NUM_KINDS))
+            {
+                case REFERENCE:
+                    reference(random, out);
+                    break;
+
+                case FUNCTION:
+                    function(random, depth, out);
+                    break;
+
+                case NUMBER:
+                    number(random, out);
+                    if (random.chance(5))
+                        out.push_back('%');
+                    break;
+
+                case STRING:
+                    string(random, out);
+                    break;
+
+                case LOGICAL:
+                    out += random.chance(50) ? "TRUE" : "FALSE";
+                    break;
+
+                case ERROR:
+                    error(random, out);
+                    break;
+
+                case ARRAY:
+                    array(random, out);
+                    break;
+
+                case SUBEXPRESSION:
+                    out.push_back('(');
+                    expression(random, depth + 1, out);
+                    out.push_back(')');
+                    break;
+            }
+        }
+
+        void infix_operator(Random& random, std::string& out) const
+        {
+            static const char* OPERATORS[] = {"+", "-", "*", "/", "^", "&", "=", "<>", "<", ">", "<=", ">="};
+            static const unsigned WEIGHTS[] = {12, 6, 8, 5, 1, 3, 2, 1, 1, 2, 1, 1};
+            out += OPERATORS[random.weighted(WEIGHTS, sizeof(WEIGHTS) / sizeof(WEIGHTS[0]))];
+        }
+
+        void function(Random& random, size_t depth, std::string& out) const
+        {
+            std::vector<unsigned> weights;
+            weights.reserve(m_options.functions.size());
+            for (const auto& f : m_options.functions)
+                weights.push_back(f.weight);
+
+            const auto& f = m_options.functions[random.weighted(weights.data(), weights.size())];
+            out += f.name;
+            out.push_back('(');
+
+            const unsigned num_arguments = unsigned(random.between(f.min_arguments, std::max(f.min_arguments, f.max_arguments)));
+            for (unsigned i = 0; i < num_arguments; ++i)
+            {
+                if (i > 0)
+                    out.push_back(m_list_separator);
+                expression(random, depth + 1, out);
+            }
+
+            out.push_back(')');
+        }
+
+        void number(Random& random, std::string& out) const
+        {
+            const uint64_t form = random.below(10);
+            if (form == 9)
+            {
+                // Scientific notation, eg. 1.5E+3
+                out.push_back(char('1' + random.below(9)));
+                out.push_back(m_decimal_separator);
+                digits(random, size_t(random.between(1, 3)), out);
+                out += random.chance(50) ? "E+" : "E-";
+                digits(random, size_t(random.between(1, 2)), out);
+                return;
+            }
+
+            digits(random, size_t(random.between(1, 4)), out);
+            if (form >= 6)
+            {
+                out.push_back(m_decimal_separator);
+                digits(random, size_t(random.between(1, 3)), out);
+            }
+        }
+
+        void digits(Random& random, size_t count, std::string& out) const
+        {
+            for (size_t i = 0; i < count; ++i)
+                out.push_back(char('0' + random.below(10)));
+        }
+
+        void string(Random& random, std::string& out) const
+        {
+            static const char CHARS[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ,.;:-/()[]{}'!#$%&*";
+
+            out.push_back('"');
+            const size_t length = size_t(random.below(m_options.max_string_length + 1));
+            for (size_t i = 0; i < length; ++i)
+            {
+                if (random.chance(3))
+                    out += "\"\"";
+                else
+                    out.push_back(CHARS[random.below(sizeof(CHARS) - 1)]);
+            }
+            out.push_back('"');
+        }
+
+        void error(Random& random, std::string& out) const
+        {
+            static const char* ERRORS[] = {"#N/A", "#REF!", "#VALUE!", "#DIV/0!", "#NAME?", "#NUM!", "#NULL!", "#SPILL!"};
+            static const unsigned WEIGHTS[] = {8, 4, 4, 3, 2, 1, 1, 1};
+            out += ERRORS[random.weighted(WEIGHTS, sizeof(WEIGHTS) / sizeof(WEIGHTS[0]))];
+        }
+
+        void array(Random& random, std::string& out) const
+        {
+            const size_t rows = size_t(random.between(1, std::max<size_t>(1, m_options.max_array_rows)));
+            const size_t columns = size_t(random.between(1, std::max<size_t>(1, m_options.max_array_columns)));
+
+            out.push_back(m_left_brace);
+            for (size_t row = 0; row < rows; ++row)
+            {
+                if (row > 0)
+                    out.push_back(m_row_separator);
+
+                for (size_t column = 0; column < columns; ++column)
+                {
+                    if (column > 0)
+                        out.push_back(m_list_separator);
+
+                    const uint64_t kind = random.below(10);
+                    if (kind < 7)
+                        number(random, out);
+                    else if (kind < 9)
+                        string(random, out);
+                    else
+                        out += random.chance(50) ? "TRUE" : "FALSE";
+                }
+            }
+            out.push_back(m_right_brace);
+        }
+
+        void reference(Random& random, std::string& out) const
+        {
+            const unsigned weights[] = {
+                m_options.a1_weight,
+                m_options.r1c1_weight,
+                m_options.external_weight,
+                m_options.structured_weight
+            };
+
+            switch (random.weighted(weights, 4))
+            {
+                case 0:
+                    if (random.chance(15))
+                        sheet_name(random, out, false);
+                    a1_reference(random, out);
+                    break;
+
+                case 1:
+                    if (random.chance(15))
+                        sheet_name(random, out, false);
+                    r1c1_reference(random, out);
+                    break;
+
+                case 2:
+                    sheet_name(random, out, true);
+                    if (m_options.r1c1_weight > m_options.a1_weight)
+                        r1c1_reference(random, out);
+                    else
+                        a1_reference(random, out);
+                    break;
+
+                case 3:
+                    structured_reference(random, out);
+                    break;
+            }
+        }
+
+        // Sheet name followed by '!', optionally quoted and with a workbook name
+        void sheet_name(Random& random, std::string& out, bool external) const
+        {
+            static const char* SHEETS[] = {"Sheet1", "Sheet2", "Data", "Inputs", "Summary Q1", "Bob's Data"};
+            static const char* BOOKS[] = {"Book1.xlsx", "Model.xlsm", "Budget 2024.xlsx"};
+
+            const std::string sheet = SHEETS[random.below(6)];
+            const std::string book = external ? BOOKS[random.below(3)] : "";
+
+            const bool quoted = sheet.find_first_of(" '") != std::string::npos ||
+                                book.find(' ') != std::string::npos;
+            if (quoted)
+                out.push_back('\'');
+
+            if (external)
+            {
+                out.push_back(m_left_bracket);
+                out += book;
+                out.push_back(m_right_bracket);
+            }
+
+            for (char c : sheet)
+            {
+                out.push_back(c);
+                if (c == '\'')
+                    out.push_back('\'');
+            }
+
+            if (quoted)
+                out.push_back('\'');
+            out.push_back('!');
+        }
+
+        void a1_reference(Random& random, std::string& out) const
+        {
+            a1_cell(random, out);
+
+            const uint64_t form = random.below(10);
+            if (form < 4)
+            {
+                out.push_back(':');
+                a1_cell(random, out);
+            }
+            else if (form == 4)
+            {
+                out.push_back('#');
+            }
+        }
+
+        void a1_cell(Random& random, std::string& out) const
+        {
+            // Columns A to XFD and rows 1 to 1048576, mostly near the top left
+            const uint64_t column = random.chance(90) ? random.below(26) : random.below(16384);
+            const uint64_t row = 1 + (random.chance(90) ? random.below(1000) : random.below(1048576));
+
+            if (random.chance(30))
+                out.push_back('$');
+
+            char letters[3];
+            size_t num_letters = 0;
+            for (uint64_t c = column + 1; c > 0; c = (c - 1) / 26)
+                letters[num_letters++] = char('A' + (c - 1) % 26);
+            while (num_letters > 0)
+                out.push_back(letters[--num_letters]);
+
+            if (random.chance(30))
+                out.push_back('$');
+            out += std::to_string(row);
+        }
+
+        void r1c1_reference(Random& random, std::string& out) const
+        {
+            r1c1_cell(random, out);
+            if (random.chance(30))
+            {
+                out.push_back(':');
+                r1c1_cell(random, out);
+            }
+        }
+
+        void r1c1_cell(Random& random, std::string& out) const
+        {
+            auto part = [&](char letter) {
+                out.push_back(letter);
+
+                const uint64_t form = random.below(10);
+                if (form < 5)
+                {
+                    // Relative, eg. R[-1]
+                    const int64_t offset = int64_t(random.between(1, 20));
+                    out.push_back(m_left_bracket);
+                    out += std::to_string(random.chance(50) ? -offset : offset);
+                    out.push_back(m_right_bracket);
+                }
+                else if (form < 9)
+                {
+                    // Absolute, eg. R5
+                    out += std::to_string(1 + random.below(1000));
+                }
+                // else the current row or column, eg. RC
+            };
+
+            part('R');
+            part('C');
+        }
+
+        void structured_reference(Random& random, std::string& out) const
+        {
+            static const char* TABLES[] = {"Table1", "Sales", "tblPrices"};
+            static const char* COLUMNS[] = {"Amount", "Price", "Unit Price", "Qty", "Date"};
+            static const char* ITEMS[] = {"#All", "#Data", "#Headers", "#Totals", "#This Row"};
+
+            auto column = [&]() {
+                out.push_back(m_left_bracket);
+                out += COLUMNS[random.below(5)];
+                out.push_back(m_right_bracket);
+            };
+
+            const uint64_t form = random.below(5);
+            if (form == 0)
+            {
+                // [@Amount]
+                out.push_back(m_left_bracket);
+                out.push_back('@');
+                out += COLUMNS[random.below(4)];
+                out.push_back(m_right_bracket);
+                return;
+            }
+
+            out += TABLES[random.below(3)];
+            if (form == 1)
+            {
+                // Table1[Amount]
+                column();
+            }
+            else if (form == 2)
+            {
+                // Table1[#All]
+                out.push_back(m_left_bracket);
+                out += ITEMS[random.below(4)];
+                out.push_back(m_right_bracket);
+            }
+            else
+            {
+                // Table1[[#This Row],[Amount]] or Table1[[#Headers],[Price]:[Amount]]
+                out.push_back(m_left_bracket);
+                out.push_back(m_left_bracket);
+                out += ITEMS[random.below(5)];
+                out.push_back(m_right_bracket);
+                out.push_back(m_list_separator);
+                column();
+                if (form == 4)
+                {
+                    out.push_back(':');
+                    column();
+                }
+                out.push_back(m_right_bracket);
+            }
+        }
+
+        GeneratorOptions m_options;
+        char m_left_brace;
+        char m_right_brace;
+        char m_left_bracket;
+        char m_right_bracket;
+        char m_list_separator;
+        char m_decimal_separator;
+        char m_row_separator;
+    };
+}
+
+
+#endif // _XLFPARSER_GENERATOR_H_
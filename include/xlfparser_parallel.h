@@ -0,0 +1,384 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef _XLFPARSER_PARALLEL_H_
+#define _XLFPARSER_PARALLEL_H_
+
+#include "xlfparser.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace xlfparser {
+
+    /**
+     * Fixed size pool of threads for running the same job on every thread at once.
+     *
+     * The thread calling run takes part in the job, so a pool of size 1 doesn't
+     * start any threads of its own.
+     */
+    class ThreadPool
+    {
+    public:
+        /**
+         * @param threads Number of threads to run jobs on, or 0 to use one per hardware thread.
+         */
+        explicit ThreadPool(size_t threads = 0)
+        {
+            if (threads == 0)
+                threads = std::thread::hardware_concurrency();
+
+            if (threads == 0)
+                threads = 1;
+
+            m_threads.reserve(threads - 1);
+            for (size_t i = 1; i < threads; ++i)
+                m_threads.emplace_back([this, i] { worker(i); });
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+            }
+            m_start.notify_all();
+
+            for (auto& thread : m_threads)
+                thread.join();
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /* Number of threads jobs are run on, including the calling thread. */
+        size_t size() const { return m_threads.size() + 1; }
+
+        /**
+         * Call job(i) for each i in [0, size()) concurrently, one per thread, and wait for them all to finish.
+         *
+         * If any of the calls throw, the first exception is rethrown once they have all finished.
+         * Only one job runs at a time; calls from other threads wait for the current job to finish.
+         */
+        void run(const std::function<void(size_t)>& job)
+        {
+            std::lock_guard<std::mutex> run_lock(m_run_mutex);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_job = &job;
+                m_error = nullptr;
+                m_remaining = m_threads.size();
+                ++m_generation;
+            }
+            m_start.notify_all();
+
+            call(0);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished.wait(lock, [this] { return m_remaining == 0; });
+            m_job = nullptr;
+
+            if (m_error)
+                std::rethrow_exception(m_error);
+        }
+
+    private:
+        void call(size_t i)
+        {
+            try
+            {
+                (*m_job)(i);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error)
+                    m_error = std::current_exception();
+            }
+        }
+
+        void worker(size_t i)
+        {
+            size_t generation = 0;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_start.wait(lock, [&] { return m_stopping || m_generation != generation; });
+                    if (m_stopping)
+                        return;
+                    generation = m_generation;
+                }
+
+                call(i);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_remaining == 0)
+                    m_finished.notify_one();
+            }
+        }
+
+        std::vector<std::thread> m_threads;
+        std::mutex m_run_mutex;
+        std::mutex m_mutex;
+        std::condition_variable m_start;
+        std::condition_variable m_finished;
+        const std::function<void(size_t)>* m_job = nullptr;
+        std::exception_ptr m_error;
+        size_t m_remaining = 0;
+        size_t m_generation = 0;
+        bool m_stopping = false;
+    };
+
+    /*
+     * Range of chunk indices owned by one worker. The owner takes chunks from the front
+     * and other workers steal them from the back once they have run out of their own.
+     */
+    class alignas(64) _ChunkQueue
+    {
+    public:
+        void reset(uint32_t front, uint32_t back)
+        {
+            m_range.store(pack(front, back), std::memory_order_relaxed);
+        }
+
+        bool pop(uint32_t& chunk)
+        {
+            uint64_t range = m_range.load(std::memory_order_relaxed);
+            while (front(range) < back(range))
+            {
+                if (m_range.compare_exchange_weak(range, pack(front(range) + 1, back(range))))
+                {
+                    chunk = front(range);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool steal(uint32_t& chunk)
+        {
+            uint64_t range = m_range.load(std::memory_order_relaxed);
+            while (front(range) < back(range))
+            {
+                if (m_range.compare_exchange_weak(range, pack(front(range), back(range) - 1)))
+                {
+                    chunk = back(range) - 1;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        static uint64_t pack(uint32_t front, uint32_t back) { return (uint64_t(front) << 32) | back; }
+        static uint32_t front(uint64_t range) { return uint32_t(range >> 32); }
+        static uint32_t back(uint64_t range) { return uint32_t(range); }
+
+        std::atomic<uint64_t> m_range{0};
+    };
+
+    /*
+     * Tokenize formulas[0..count) on the pool, appending them to batch in input order.
+     */
+    template <typename char_type>
+    inline void _tokenize_batch_parallel(ThreadPool& pool,
+                                         const std::basic_string_view<char_type>* formulas,
+                                         size_t count,
+                                         const Options<char_type>& options,
+                                         TokenBatch& batch)
+    {
+        // Split the formulas into chunks of roughly equal numbers of characters
+        const size_t chunk_chars = 16 * 1024;
+        const size_t chunk_formulas = 1024;
+
+        std::vector<size_t> chunks{0};  // first formula in each chunk, plus count
+        size_t chars = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            chars += formulas[i].size();
+            if (chars >= chunk_chars || i + 1 - chunks.back() >= chunk_formulas)
+            {
+                chunks.push_back(i + 1);
+                chars = 0;
+            }
+        }
+        if (chunks.back() != count)
+            chunks.push_back(count);
+
+        const size_t num_chunks = chunks.size() - 1;
+        const size_t num_workers = pool.size();
+
+        // Each worker starts with an equal share of consecutive chunks
+        std::unique_ptr<_ChunkQueue[]> queues(new _ChunkQueue[num_workers]);
+        for (size_t w = 0; w < num_workers; ++w)
+            queues[w].reset(uint32_t(num_chunks * w / num_workers), uint32_t(num_chunks * (w + 1) / num_workers));
+
+        // Where each chunk's formulas ended up in its worker's arena
+        struct Placement
+        {
+            size_t worker;
+            size_t first;  // index of the chunk's first formula in the arena
+            size_t output;  // index of the chunk's first token in the output
+        };
+
+        std::vector<Placement> placements(num_chunks);
+        std::vector<TokenBatch> arenas(num_workers);
+
+        pool.run([&](size_t w) {
+            TokenBatch& arena = arenas[w];
+            uint32_t chunk;
+
+            auto tokenize_chunk = [&](uint32_t chunk) {
+                placements[chunk] = {w, arena.size(), 0};
+                _tokenize_batch(formulas + chunks[chunk], formulas + chunks[chunk + 1], options, arena);
+            };
+
+            while (queues[w].pop(chunk))
+                tokenize_chunk(chunk);
+
+            // Out of work, so help the others with theirs
+            for (size_t i = 1; i < num_workers; ++i)
+                while (queues[(w + i) % num_workers].steal(chunk))
+                    tokenize_chunk(chunk);
+        });
+
+        // Stitch the arenas together in input order
+        const size_t first_token = batch.tokens.size();
+        const size_t first_formula = batch.size();
+
+        size_t total = first_token;
+        for (size_t c = 0; c < num_chunks; ++c)
+        {
+            const Placement& placement = placements[c];
+            const TokenBatch& arena = arenas[placement.worker];
+            const size_t formulas_in_chunk = chunks[c + 1] - chunks[c];
+
+            placements[c].output = total;
+            total += arena.offsets[placement.first + formulas_in_chunk] - arena.offsets[placement.first];
+        }
+
+        batch.tokens.resize(total, Token(0, 0, Token::Type::Unknown, Token::Subtype::None));
+        batch.offsets.resize(first_formula + count + 1);
+        batch.status.resize(first_formula + count);
+
+        pool.run([&](size_t w) {
+            for (size_t c = w; c < num_chunks; c += num_workers)
+            {
+                const Placement& placement = placements[c];
+                const TokenBatch& arena = arenas[placement.worker];
+                const size_t base = arena.offsets[placement.first];
+                const size_t out = first_formula + chunks[c];
+
+                std::copy(arena.tokens.begin() + base,
+                          arena.tokens.begin() + arena.offsets[placement.first + chunks[c + 1] - chunks[c]],
+                          batch.tokens.begin() + placement.output);
+
+                for (size_t i = 0; i < chunks[c + 1] - chunks[c]; ++i)
+                {
+                    batch.offsets[out + i + 1] = placement.output + arena.offsets[placement.first + i + 1] - base;
+                    batch.status[out + i] = arena.status[placement.first + i];
+                }
+            }
+        });
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas using a pool of threads.
+     *
+     * The formulas are split into chunks that are shared out between the threads, with
+     * threads that run out of work taking chunks from the others. Each thread tokenizes
+     * into its own arena and the results are copied into a single TokenBatch in the same
+     * order as the formulas, exactly as tokenize_batch would return them.
+     *
+     * @param pool Thread pool to tokenize the formulas on.
+     * @param formulas Array of Excel formulas to tokenize.
+     * @param count Number of formulas in the array.
+     * @param options Options controlling how the Excel formulas are tokenized.
+     * @return The tokens for all the formulas.
+     */
+    template <typename char_type>
+    inline TokenBatch tokenize_batch(ThreadPool& pool,
+                                     const std::basic_string_view<char_type>* formulas,
+                                     size_t count,
+                                     const Options<char_type>& options)
+    {
+        TokenBatch batch;
+        _tokenize_batch_parallel(pool, formulas, count, options, batch);
+        return batch;
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas using a pool of threads.
+     *
+     * @param pool Thread pool to tokenize the formulas on.
+     * @param formulas Array of Excel formulas to tokenize.
+     * @param count Number of formulas in the array.
+     * @return The tokens for all the formulas.
+     */
+    template <typename char_type>
+    inline TokenBatch tokenize_batch(ThreadPool& pool, const std::basic_string_view<char_type>* formulas, size_t count)
+    {
+        return tokenize_batch(pool, formulas, count, {});
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas using a pool of threads.
+     *
+     * @param pool Thread pool to tokenize the formulas on.
+     * @param formulas Container of Excel formula strings or string views.
+     * @param options Options controlling how the Excel formulas are tokenized.
+     * @return The tokens for all the formulas.
+     */
+    template <typename range_type, typename char_type = typename range_type::value_type::value_type>
+    inline TokenBatch tokenize_batch(ThreadPool& pool, const range_type& formulas, const Options<char_type>& options)
+    {
+        std::vector<std::basic_string_view<char_type>> views(std::begin(formulas), std::end(formulas));
+        return tokenize_batch(pool, views.data(), views.size(), options);
+    }
+
+    /**
+     * Generate Tokens for a batch of Excel formulas using a pool of threads.
+     *
+     * @param pool Thread pool to tokenize the formulas on.
+     * @param formulas Container of Excel formula strings or string views.
+     * @return The tokens for all the formulas.
+     */
+    template <typename range_type, typename char_type = typename range_type::value_type::value_type>
+    inline TokenBatch tokenize_batch(ThreadPool& pool, const range_type& formulas)
+    {
+        return tokenize_batch(pool, formulas, Options<char_type>{});
+    }
+}
+
+
+#endif // _XLFPARSER_PARALLEL_H_
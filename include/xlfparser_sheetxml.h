@@ -0,0 +1,536 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef _XLFPARSER_SHEETXML_H_
+#define _XLFPARSER_SHEETXML_H_
+
+#include "xlfparser.h"
+#include "xlfparser_corpus.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+namespace xlfparser {
+
+    /**
+     * A formula found in a worksheet by for_each_sheet_formula.
+     *
+     * The formula and tokens are only valid until the callback returns.
+     */
+    struct SheetFormula
+    {
+        // Cell the formula is in (1-based)
+        size_t row;
+        size_t col;
+
+        // Formula text as stored in the XML, without a leading '=' and with entities decoded
+        std::string_view formula;
+
+        // Tokens for the formula text, empty if the formula is invalid
+        TokenRange tokens;
+        TokenBatch::Status status;
+
+        // True for cells sharing the formula of another cell, in which case the
+        // formula and tokens are those of the master cell and any relative
+        // references need adjusting by the offset from the master cell.
+        bool shared;
+        size_t master_row;
+        size_t master_col;
+    };
+
+    /*
+     * Helpers for scanning worksheet XML without building a DOM.
+     */
+    struct _SheetXml
+    {
+        static bool is_space(char c)
+        {
+            return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        }
+
+        static const char* find(const char* pos, const char* end, const char* str)
+        {
+            const size_t length = std::strlen(str);
+            while (true)
+            {
+                const char* found = static_cast<const char*>(std::memchr(pos, str[0], end - pos));
+                if (found == nullptr || size_t(end - found) < length)
+                    return end;
+                if (std::memcmp(found, str, length) == 0)
+                    return found;
+                pos = found + 1;
+            }
+        }
+
+        // Find the value of an attribute in the attributes of a tag
+        static bool attribute(const char* pos, const char* end, std::string_view name, std::string_view& value)
+        {
+            while (pos < end)
+            {
+                while (pos < end && is_space(*pos))
+                    ++pos;
+
+                const char* name_start = pos;
+                while (pos < end && *pos != '=' && !is_space(*pos))
+                    ++pos;
+                const std::string_view attr_name(name_start, pos - name_start);
+
+                while (pos < end && *pos != '"' && *pos != '\'')
+                    ++pos;
+                if (pos == end)
+                    return false;
+
+                const char quote = *pos++;
+                const char* value_start = pos;
+                while (pos < end && *pos != quote)
+                    ++pos;
+
+                if (attr_name == name)
+                {
+                    value = std::string_view(value_start, pos - value_start);
+                    return true;
+                }
+
+                ++pos;
+            }
+
+            return false;
+        }
+
+        static size_t to_unsigned(std::string_view str)
+        {
+            size_t value = 0;
+            for (char c : str)
+            {
+                if (c < '0' || c > '9')
+                    break;
+                value = value * 10 + (c - '0');
+            }
+            return value;
+        }
+
+        static void append_utf8(std::string& out, unsigned long code)
+        {
+            if (code < 0x80)
+            {
+                out.push_back(char(code));
+            }
+            else if (code < 0x800)
+            {
+                out.push_back(char(0xC0 | (code >> 6)));
+                out.push_back(char(0x80 | (code & 0x3F)));
+            }
+            else if (code < 0x10000)
+            {
+                out.push_back(char(0xE0 | (code >> 12)));
+                out.push_back(char(0x80 | ((code >> 6) & 0x3F)));
+                out.push_back(char(0x80 | (code & 0x3F)));
+            }
+            else
+            {
+                out.push_back(char(0xF0 | (code >> 18)));
+                out.push_back(char(0x80 | ((code >> 12) & 0x3F)));
+                out.push_back(char(0x80 | ((code >> 6) & 0x3F)));
+                out.push_back(char(0x80 | (code & 0x3F)));
+            }
+        }
+
+        // Parse a character reference, eg. #65 or #x41, to a code point that can be encoded as UTF-8
+        static bool char_reference(std::string_view entity, unsigned long& code)
+        {
+            if (entity.size() < 2 || entity[0] != '#')
+                return false;
+
+            const bool hex = entity[1] == 'x' || entity[1] == 'X';
+            const std::string digits(entity.substr(hex ? 2 : 1));
+
+            // strtoul skips whitespace and accepts a sign or 0x prefix, which references can't have
+            const char* allowed = hex ? "0123456789abcdefABCDEF" : "0123456789";
+            if (digits.empty() || digits.find_first_not_of(allowed) != std::string::npos)
+                return false;
+
+            char* digits_end = nullptr;
+            code = std::strtoul(digits.c_str(), &digits_end, hex ? 16 : 10);
+            return digits_end == digits.c_str() + digits.size() &&
+                   code != 0 && code <= 0x10FFFF && (code < 0xD800 || code > 0xDFFF);
+        }
+
+        // Append text to out, replacing any XML entities
+        static void decode(const char* pos, const char* end, std::string& out)
+        {
+            while (pos < end)
+            {
+                const char* amp = static_cast<const char*>(std::memchr(pos, '&', end - pos));
+                if (amp == nullptr)
+                {
+                    out.append(pos, end - pos);
+                    return;
+                }
+
+                out.append(pos, amp - pos);
+                const char* semi = static_cast<const char*>(std::memchr(amp, ';', end - amp));
+                if (semi == nullptr)
+                {
+                    out.append(amp, end - amp);
+                    return;
+                }
+
+                const std::string_view entity(amp + 1, semi - amp - 1);
+                unsigned long code = 0;
+                if (entity == "lt") out.push_back('<');
+                else if (entity == "gt") out.push_back('>');
+                else if (entity == "amp") out.push_back('&');
+                else if (entity == "quot") out.push_back('"');
+                else if (entity == "apos") out.push_back('\'');
+                else if (char_reference(entity, code)) append_utf8(out, code);
+                else
+                {
+                    // Not an entity we know about or not a valid character, so leave it as it is
+                    out.append(amp, semi + 1 - amp);
+                }
+
+                pos = semi + 1;
+            }
+        }
+    };
+
+    /**
+     * Find and tokenize all the formulas in a worksheet's XML (xl/worksheets/sheetN.xml in an XLSX file).
+     *
+     * The XML is scanned in a single pass without building a DOM, calling callback with a
+     * SheetFormula for each <f> element in a <c> element in <sheetData>. Formulas elsewhere,
+     * eg. <xm:f> in data validations and conditional formatting in <extLst>, aren't cell
+     * formulas and are skipped. Cells sharing a formula (t="shared") are passed the tokens
+     * of the master cell rather than being tokenized again.
+     *
+     * @param xml The worksheet XML.
+     * @param size Number of characters in the XML.
+     * @param callback Function called with a SheetFormula for each formula found.
+     * @param options Options controlling how the Excel formulas are tokenized.
+     * @return The number of formulas found.
+     */
+    template <typename callback_type>
+    inline size_t for_each_sheet_formula(const char* xml,
+                                         size_t size,
+                                         callback_type&& callback,
+                                         const Options<char>& options)
+    {
+        struct Master
+        {
+            std::string formula;  // a copy, as the XML may be a temporary buffer
+            std::vector<Token> tokens;
+            TokenBatch::Status status;
+            size_t row;
+            size_t col;
+            size_t last_row;  // last row using the formula
+        };
+
+        // Formulas in the XML don't start with '='
+        Options<char> body_options = options;
+        body_options.leading_equals = false;
+
+        std::stack<Token::Type> stack;
+        std::vector<Token> tokens;
+        std::string text;
+
+        // Shared formulas by their si attribute. They're dropped once past the last row using them.
+        std::unordered_map<size_t, Master> masters;
+        size_t min_last_row = size_t(-1);
+
+        auto tokenize_text = [&](std::string_view text) {
+            tokens.clear();
+            auto status = TokenBatch::Status::Ok;
+            try
+            {
+                _tokenize(text.data(), text.size(), body_options, stack, tokens);
+            }
+            catch (const invalid_formula&)
+            {
+                tokens.clear();
+                status = TokenBatch::Status::InvalidFormula;
+            }
+
+            while (!stack.empty())
+                stack.pop();
+
+            return status;
+        };
+
+        // Prefix of the worksheet elements, eg. "x:" in <x:sheetData>, usually empty.
+        // Elements with any other prefix are from extensions to the worksheet.
+        std::string_view prefix;
+        auto is_element = [&](std::string_view element, std::string_view local_name) {
+            return element.size() == prefix.size() + local_name.size()
+                && element.substr(0, prefix.size()) == prefix
+                && element.substr(prefix.size()) == local_name;
+        };
+
+        const char* pos = xml;
+        const char* end = xml + size;
+        size_t row = 0;
+        size_t col = 0;
+        size_t count = 0;
+        bool in_sheet_data = false;
+        bool in_cell = false;
+
+        while (pos < end)
+        {
+            const char* tag = static_cast<const char*>(std::memchr(pos, '<', end - pos));
+            if (tag == nullptr || ++tag == end)
+                break;
+
+            // Skip comments, CDATA, declarations and processing instructions
+            if (*tag == '!' || *tag == '?')
+            {
+                const char* close = (end - tag >= 3 && std::memcmp(tag, "!--", 3) == 0) ? "-->"
+                                  : (end - tag >= 8 && std::memcmp(tag, "![CDATA[", 8) == 0) ? "]]>"
+                                  : ">";
+                pos = _SheetXml::find(tag, end, close);
+                continue;
+            }
+
+            // Element name, including any namespace prefix
+            const bool end_tag = *tag == '/';
+            const char* name = end_tag ? tag + 1 : tag;
+            const char* name_end = name;
+            const char* local_name = name;
+            while (name_end < end && *name_end != '>' && *name_end != '/' && !_SheetXml::is_space(*name_end))
+            {
+                if (*name_end == ':')
+                    local_name = name_end + 1;
+                ++name_end;
+            }
+
+            if (end_tag)
+            {
+                const std::string_view element(name, name_end - name);
+                if (is_element(element, "c"))
+                    in_cell = false;
+                else if (is_element(element, "sheetData"))
+                    in_sheet_data = in_cell = false;
+
+                pos = name_end;
+                continue;
+            }
+
+            // End of the start tag, skipping over quoted attribute values
+            const char* tag_end = name_end;
+            while (tag_end < end && *tag_end != '>')
+            {
+                if (*tag_end == '"' || *tag_end == '\'')
+                {
+                    const void* quote = std::memchr(tag_end + 1, *tag_end, end - tag_end - 1);
+                    tag_end = quote ? static_cast<const char*>(quote) : end;
+                    if (tag_end == end)
+                        break;
+                }
+                ++tag_end;
+            }
+
+            if (tag_end == end)
+                break;
+
+            const bool empty_element = *(tag_end - 1) == '/';
+            const char* attrs_end = empty_element ? tag_end - 1 : tag_end;
+            const std::string_view element(name, name_end - name);
+            std::string_view value;
+            pos = tag_end + 1;
+
+            if (std::string_view(local_name, name_end - local_name) == "sheetData")
+            {
+                prefix = std::string_view(name, local_name - name);
+                in_sheet_data = !empty_element;
+            }
+            else if (!in_sheet_data)
+            {
+                continue;
+            }
+            else if (is_element(element, "row"))
+            {
+                row = _SheetXml::attribute(name_end, attrs_end, "r", value) ? _SheetXml::to_unsigned(value) : row + 1;
+                col = 0;
+
+                if (row > min_last_row)
+                {
+                    min_last_row = size_t(-1);
+                    for (auto iter = masters.begin(); iter != masters.end();)
+                    {
+                        if (iter->second.last_row < row)
+                        {
+                            iter = masters.erase(iter);
+                            continue;
+                        }
+                        min_last_row = std::min(min_last_row, iter->second.last_row);
+                        ++iter;
+                    }
+                }
+            }
+            else if (is_element(element, "c"))
+            {
+                in_cell = !empty_element;
+
+                _A1Reference ref;
+                if (_SheetXml::attribute(name_end, attrs_end, "r", value)
+                        && _parse_a1_reference(value.data(), value.size(), ref)
+                        && ref.row > 0 && ref.col > 0)
+                {
+                    row = ref.row;
+                    col = ref.col;
+                }
+                else
+                {
+                    ++col;
+                }
+            }
+            else if (in_cell && is_element(element, "f"))
+            {
+                const char* content = pos;
+                const char* content_end = pos;
+                if (!empty_element)
+                {
+                    const void* close = std::memchr(pos, '<', end - pos);
+                    content_end = close ? static_cast<const char*>(close) : end;
+                    pos = content_end;
+                }
+
+                std::string_view type;
+                std::string_view si;
+                _SheetXml::attribute(name_end, attrs_end, "t", type);
+                const bool shared = type == "shared" && _SheetXml::attribute(name_end, attrs_end, "si", si);
+
+                SheetFormula formula = {row, col, {}, {nullptr, nullptr}, TokenBatch::Status::Ok, false, row, col};
+
+                if (shared && content == content_end)
+                {
+                    // Cell using a shared formula from an earlier cell
+                    auto iter = masters.find(_SheetXml::to_unsigned(si));
+                    if (iter != masters.end())
+                    {
+                        const Master& master = iter->second;
+                        formula.formula = master.formula;
+                        formula.tokens = {master.tokens.data(), master.tokens.data() + master.tokens.size()};
+                        formula.status = master.status;
+                        formula.master_row = master.row;
+                        formula.master_col = master.col;
+                    }
+                    else
+                    {
+                        formula.status = TokenBatch::Status::InvalidFormula;
+                    }
+
+                    formula.shared = true;
+                }
+                else if (content != content_end)
+                {
+                    // Only formulas containing entities need copying to decode them
+                    formula.formula = std::string_view(content, content_end - content);
+                    if (std::memchr(content, '&', content_end - content) != nullptr)
+                    {
+                        text.clear();
+                        _SheetXml::decode(content, content_end, text);
+                        formula.formula = text;
+                    }
+
+                    formula.status = tokenize_text(formula.formula);
+                    formula.tokens = {tokens.data(), tokens.data() + tokens.size()};
+
+                    if (shared)
+                    {
+                        // Keep the tokens for the other cells sharing this formula
+                        size_t last_row = row;
+                        std::string_view ref;
+                        if (_SheetXml::attribute(name_end, attrs_end, "ref", ref))
+                            _for_each_a1_reference(ref.data(), ref.size(), [&](const _A1Reference& r) {
+                                last_row = std::max(last_row, r.row);
+                            });
+
+                        Master& master = masters[_SheetXml::to_unsigned(si)];
+                        master = {std::string(formula.formula), tokens, formula.status, row, col, last_row};
+                        min_last_row = std::min(min_last_row, last_row);
+                    }
+                }
+                else
+                {
+                    // Data table formulas have no text
+                    continue;
+                }
+
+                ++count;
+                callback(static_cast<const SheetFormula&>(formula));
+            }
+        }
+
+        return count;
+    }
+
+    /**
+     * Find and tokenize all the formulas in a worksheet's XML (xl/worksheets/sheetN.xml in an XLSX file).
+     *
+     * @param xml The worksheet XML.
+     * @param size Number of characters in the XML.
+     * @param callback Function called with a SheetFormula for each formula found.
+     * @return The number of formulas found.
+     */
+    template <typename callback_type>
+    inline size_t for_each_sheet_formula(const char* xml, size_t size, callback_type&& callback)
+    {
+        return for_each_sheet_formula(xml, size, std::forward<callback_type>(callback), {});
+    }
+
+    /**
+     * Find and tokenize all the formulas in a worksheet's XML file.
+     *
+     * The file is memory mapped, so large worksheets are scanned without reading them into memory.
+     *
+     * @param path Path of an XML file extracted from an XLSX file, e.g. xl/worksheets/sheet1.xml.
+     * @param callback Function called with a SheetFormula for each formula found.
+     * @param options Options controlling how the Excel formulas are tokenized.
+     * @return The number of formulas found.
+     */
+    template <typename callback_type>
+    inline size_t for_each_sheet_formula(const std::string& path, callback_type&& callback, const Options<char>& options)
+    {
+        const MappedFile file(path);
+        return for_each_sheet_formula(file.data(), file.size(), std::forward<callback_type>(callback), options);
+    }
+
+    /**
+     * Find and tokenize all the formulas in a worksheet's XML file.
+     *
+     * @param path Path of an XML file extracted from an XLSX file, e.g. xl/worksheets/sheet1.xml.
+     * @param callback Function called with a SheetFormula for each formula found.
+     * @return The number of formulas found.
+     */
+    template <typename callback_type>
+    inline size_t for_each_sheet_formula(const std::string& path, callback_type&& callback)
+    {
+        return for_each_sheet_formula(path, std::forward<callback_type>(callback), {});
+    }
+}
+
+
+#endif // _XLFPARSER_SHEETXML_H_
@@ -0,0 +1,437 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+#ifndef _XLFPARSER_TOKENFILE_H_
+#define _XLFPARSER_TOKENFILE_H_
+
+/*
+ * Binary file format for tokenized formulas, version 1.
+ *
+ * All integers are little endian.
+ *
+ * Header (48 bytes):
+ *     char[8]  magic "XLFPTOKS"
+ *     uint32   version (1)
+ *     uint32   header size (48)
+ *     uint64   number of formulas
+ *     uint64   total number of tokens
+ *     uint64   offset of the formula index
+ *     uint64   FNV-1a checksum of everything after the header
+ *
+ * Token data, starting straight after the header. For each formula, for each token:
+ *     uint8    (type << 4) | subtype
+ *     varint   start of the token minus the start of the previous token (or 0)
+ *     varint   end of the token minus its start
+ *
+ * Formula index, 8 byte aligned, with a 24 byte entry for each formula:
+ *     uint64   offset of the formula's token data
+ *     uint64   hash of the formula text, see TokenFile::matches
+ *     uint32   number of tokens
+ *     uint8    TokenBatch::Status
+ *     uint8[3] reserved (0)
+ *
+ * Varints are unsigned LEB128, 7 bits per byte with the high bit set on all but the last byte.
+ */
+
+#include "xlfparser.h"
+#include "xlfparser_corpus.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+
+namespace xlfparser {
+
+    /* thrown by TokenFile if a file isn't a valid token file */
+    class invalid_token_file: public std::runtime_error
+    {
+    public:
+        invalid_token_file(const std::string& message): std::runtime_error(message) {};
+    };
+
+    /*
+     * Constants and helpers for reading and writing token files.
+     */
+    struct _TokenFile
+    {
+        static constexpr char magic[8] = {'X', 'L', 'F', 'P', 'T', 'O', 'K', 'S'};
+        static constexpr uint32_t version = 1;
+        static constexpr size_t header_size = 48;
+        static constexpr size_t index_entry_size = 24;
+
+        // A token is at least its packed type and subtype and two single byte varints, which
+        // limits how many tokens there can be when reserving space for them
+        static constexpr size_t min_token_size = 3;
+
+        static uint64_t checksum(uint64_t hash, const unsigned char* data, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                hash ^= data[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        template <typename char_type>
+        static uint64_t formula_hash(const char_type* formula, size_t size)
+        {
+            return _fnv1a(14695981039346656037ULL, formula, size, false);
+        }
+
+        static void store(std::string& out, uint64_t value, size_t bytes)
+        {
+            for (size_t i = 0; i < bytes; ++i, value >>= 8)
+                out.push_back(static_cast<char>(value & 0xff));
+        }
+
+        static uint64_t load(const unsigned char* data, size_t bytes)
+        {
+            uint64_t value = 0;
+            for (size_t i = bytes; i > 0; --i)
+                value = (value << 8) | data[i - 1];
+            return value;
+        }
+
+        static void store_varint(std::string& out, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<char>(value));
+        }
+
+        static uint64_t load_varint(const unsigned char*& pos, const unsigned char* end)
+        {
+            uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7)
+            {
+                if (pos == end)
+                    break;
+
+                const unsigned char byte = *pos++;
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                    return value;
+            }
+
+            throw invalid_token_file("Invalid token data");
+        }
+    };
+
+    /**
+     * Write tokenized formulas to a binary token file that can be loaded with TokenFile.
+     *
+     * @param path Path of the file to write.
+     * @param batch Tokens for the formulas, as returned by tokenize_batch.
+     * @param formulas The formulas the batch was created from, used to check the tokens match when loading them.
+     */
+    template <typename char_type>
+    inline void write_token_file(const std::string& path,
+                                 const TokenBatch& batch,
+                                 const std::basic_string_view<char_type>* formulas)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            throw std::system_error(errno, std::generic_category(), "Unable to open " + path);
+
+        // The data is written in blocks, with the checksum updated as it goes
+        std::string buffer;
+        uint64_t checksum = 14695981039346656037ULL;
+        uint64_t offset = _TokenFile::header_size;
+
+        auto flush = [&]() {
+            checksum = _TokenFile::checksum(checksum, reinterpret_cast<const unsigned char*>(buffer.data()), buffer.size());
+            file.write(buffer.data(), buffer.size());
+            offset += buffer.size();
+            buffer.clear();
+        };
+
+        file.write(std::string(_TokenFile::header_size, '\0').data(), _TokenFile::header_size);
+
+        std::vector<uint64_t> data_offsets(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            data_offsets[i] = offset + buffer.size();
+
+            size_t previous = 0;
+            for (const Token& token : batch[i])
+            {
+                if (token.start() < previous || token.end() < token.start())
+                    throw invalid_token("Tokens must be in order");
+
+                // The type and subtype are packed into one byte
+                static_assert(size_t(Token::Subtype::Spill) < 16 && size_t(Token::Type::Whitespace) < 16,
+                              "Token types and subtypes must fit in 4 bits");
+                buffer.push_back(static_cast<char>((static_cast<unsigned>(token.type()) << 4) |
+                                                   static_cast<unsigned>(token.subtype())));
+                _TokenFile::store_varint(buffer, token.start() - previous);
+                _TokenFile::store_varint(buffer, token.end() - token.start());
+                previous = token.start();
+            }
+
+            if (buffer.size() >= 1 << 20)
+                flush();
+        }
+
+        // The index is aligned so it could be read in place
+        buffer.append((8 - (offset + buffer.size()) % 8) % 8, '\0');
+        const uint64_t index_offset = offset + buffer.size();
+
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            _TokenFile::store(buffer, data_offsets[i], 8);
+            _TokenFile::store(buffer, _TokenFile::formula_hash(formulas[i].data(), formulas[i].size()), 8);
+            _TokenFile::store(buffer, batch.offsets[i + 1] - batch.offsets[i], 4);
+            _TokenFile::store(buffer, static_cast<uint64_t>(batch.status[i]), 4);
+
+            if (buffer.size() >= 1 << 20)
+                flush();
+        }
+
+        flush();
+
+        std::string header(_TokenFile::magic, sizeof(_TokenFile::magic));
+        _TokenFile::store(header, _TokenFile::version, 4);
+        _TokenFile::store(header, _TokenFile::header_size, 4);
+        _TokenFile::store(header, batch.size(), 8);
+        _TokenFile::store(header, batch.tokens.size(), 8);
+        _TokenFile::store(header, index_offset, 8);
+        _TokenFile::store(header, checksum, 8);
+
+        file.seekp(0);
+        file.write(header.data(), header.size());
+
+        if (!file.flush())
+            throw std::system_error(errno, std::generic_category(), "Unable to write " + path);
+    }
+
+    /**
+     * Write tokenized formulas to a binary token file that can be loaded with TokenFile.
+     *
+     * @param path Path of the file to write.
+     * @param batch Tokens for the formulas, as returned by tokenize_batch.
+     * @param formulas Container of the formulas the batch was created from.
+     */
+    template <typename range_type, typename char_type = typename range_type::value_type::value_type>
+    inline void write_token_file(const std::string& path, const TokenBatch& batch, const range_type& formulas)
+    {
+        std::vector<std::basic_string_view<char_type>> views(std::begin(formulas), std::end(formulas));
+        if (views.size() != batch.size())
+            throw std::invalid_argument("Number of formulas doesn't match the batch");
+
+        write_token_file(path, batch, views.data());
+    }
+
+    /**
+     * Memory mapped binary token file written by write_token_file.
+     *
+     * Tokens are decoded straight from the mapping when they're requested, so
+     * opening a file only needs to read its header.
+     */
+    class TokenFile
+    {
+    public:
+        /**
+         * @param path Path of the token file.
+         * @param verify If true, check the file's checksum, which reads the whole file.
+         */
+        explicit TokenFile(const std::string& path, bool verify = true)
+            : m_file(path)
+        {
+            const unsigned char* data = this->data();
+            if (m_file.size() < _TokenFile::header_size
+                    || std::memcmp(data, _TokenFile::magic, sizeof(_TokenFile::magic)) != 0)
+                throw invalid_token_file("Not a token file: " + path);
+
+            if (_TokenFile::load(data + 8, 4) != _TokenFile::version)
+                throw invalid_token_file("Unsupported token file version: " + path);
+
+            m_size = _TokenFile::load(data + 16, 8);
+            m_token_count = _TokenFile::load(data + 24, 8);
+            m_index_offset = _TokenFile::load(data + 32, 8);
+
+            if (m_index_offset < _TokenFile::header_size
+                    || m_index_offset > m_file.size()
+                    || (m_file.size() - m_index_offset) / _TokenFile::index_entry_size != m_size
+                    || (m_file.size() - m_index_offset) % _TokenFile::index_entry_size != 0)
+                throw invalid_token_file("Corrupt token file: " + path);
+
+            if (verify && !this->verify())
+                throw invalid_token_file("Token file checksum mismatch: " + path);
+        }
+
+        /* Number of formulas in the file. */
+        size_t size() const { return m_size; }
+
+        /* Total number of tokens for all the formulas. */
+        size_t token_count() const { return m_token_count; }
+
+        /* Check the file's checksum. */
+        bool verify() const
+        {
+            const uint64_t checksum = _TokenFile::checksum(14695981039346656037ULL,
+                                                           data() + _TokenFile::header_size,
+                                                           m_file.size() - _TokenFile::header_size);
+            return checksum == _TokenFile::load(data() + 40, 8);
+        }
+
+        /* Whether formula i tokenized successfully. */
+        TokenBatch::Status status(size_t i) const
+        {
+            return static_cast<TokenBatch::Status>(entry(i)[20]);
+        }
+
+        /* Number of tokens for formula i. */
+        size_t token_count(size_t i) const
+        {
+            return static_cast<size_t>(_TokenFile::load(entry(i) + 16, 4));
+        }
+
+        /**
+         * Check whether formula i in the file was created from a formula.
+         *
+         * @param i Index of the formula in the file.
+         * @param formula The Excel formula.
+         * @param size Number of characters in the formula string.
+         * @return True if the formula's hash matches the one stored in the file.
+         */
+        template <typename char_type>
+        bool matches(size_t i, const char_type* formula, size_t size) const
+        {
+            return _TokenFile::load(entry(i) + 8, 8) == _TokenFile::formula_hash(formula, size);
+        }
+
+        template <typename char_type>
+        bool matches(size_t i, std::basic_string_view<char_type> formula) const
+        {
+            return matches(i, formula.data(), formula.size());
+        }
+
+        /**
+         * Decode the tokens for a formula, appending them to a vector.
+         *
+         * @param i Index of the formula in the file.
+         * @param tokens Vector to append the tokens to.
+         */
+        void tokens(size_t i, std::vector<Token>& tokens) const
+        {
+            const unsigned char* pos = data() + _TokenFile::load(entry(i), 8);
+            const unsigned char* end = (i + 1 < m_size) ? data() + _TokenFile::load(entry(i + 1), 8)
+                                                        : data() + m_index_offset;
+
+            if (pos < data() + _TokenFile::header_size || pos > end || end > data() + m_index_offset)
+                throw invalid_token_file("Invalid token data");
+
+            // The count is only trusted as far as there's data for
+            const size_t count = token_count(i);
+            tokens.reserve(tokens.size() + std::min(count, size_t(end - pos) / _TokenFile::min_token_size));
+
+            size_t start = 0;
+            for (size_t n = 0; n < count; ++n)
+            {
+                if (pos == end)
+                    throw invalid_token_file("Invalid token data");
+
+                const unsigned char packed = *pos++;
+                if ((packed >> 4) > size_t(Token::Type::Whitespace) || (packed & 0x0f) > size_t(Token::Subtype::Spill))
+                    throw invalid_token_file("Invalid token data");
+
+                start += static_cast<size_t>(_TokenFile::load_varint(pos, end));
+                const size_t length = static_cast<size_t>(_TokenFile::load_varint(pos, end));
+
+                tokens.emplace_back(start,
+                                    start + length,
+                                    static_cast<Token::Type>(packed >> 4),
+                                    static_cast<Token::Subtype>(packed & 0x0f));
+            }
+
+            // The data for a formula is exactly its tokens, the last one followed by the padding
+            // that aligns the index
+            const bool padding = i + 1 == m_size && end - pos < 8 &&
+                                 std::all_of(pos, end, [](unsigned char c) { return c == 0; });
+            if (pos != end && !padding)
+                throw invalid_token_file("Invalid token data");
+        }
+
+        /**
+         * Decode the tokens for a formula.
+         *
+         * @param i Index of the formula in the file.
+         * @return A vector of tokens.
+         */
+        std::vector<Token> tokens(size_t i) const
+        {
+            std::vector<Token> result;
+            tokens(i, result);
+            return result;
+        }
+
+        /* Decode the tokens for all the formulas into a single batch. */
+        TokenBatch batch() const
+        {
+            // The header isn't checked against the data unless the file was verified
+            TokenBatch batch;
+            batch.tokens.reserve(std::min(m_token_count,
+                                          (m_index_offset - _TokenFile::header_size) / _TokenFile::min_token_size));
+            batch.offsets.reserve(m_size + 1);
+            batch.status.reserve(m_size);
+
+            for (size_t i = 0; i < m_size; ++i)
+            {
+                tokens(i, batch.tokens);
+                batch.offsets.push_back(batch.tokens.size());
+                batch.status.push_back(status(i));
+            }
+
+            return batch;
+        }
+
+    private:
+        const unsigned char* data() const { return reinterpret_cast<const unsigned char*>(m_file.data()); }
+
+        const unsigned char* entry(size_t i) const
+        {
+            if (i >= m_size)
+                throw std::out_of_range("Formula index out of range");
+            return data() + m_index_offset + i * _TokenFile::index_entry_size;
+        }
+
+        MappedFile m_file;
+        size_t m_size;
+        size_t m_token_count;
+        size_t m_index_offset;
+    };
+}
+
+
+#endif // _XLFPARSER_TOKENFILE_H_
@@ -0,0 +1,84 @@
+"""Compare tokenize_many with calling tokenize for each formula.
+
+Usage: python bench/bench_tokenize_many.py [--count=N] [--threads=N,...] [FILE]
+
+FILE has one formula per line, eg. from the xlfgen tool in the C++ build. Without
+a file a reproducible set of formulas is made up.
+"""
+from xlfparser import tokenize, tokenize_many
+import argparse
+import random
+import time
+
+
+def make_formulas(count, seed=0):
+    rnd = random.Random(seed)
+    templates = [
+        "=SUM({r}:{r})+{n}",
+        "=IF({r}>{n},\"yes\",\"no\")",
+        "=VLOOKUP({r},Sheet2!$A$1:$D$100,{i},FALSE)*{n}",
+        "=AVERAGE({r},{r},{r})/{n}%",
+        "=INDEX(Table1[[#This Row],[Amount]],{i})&\"{s}\"",
+        "={{{n},{n};{n},{n}}}",
+    ]
+
+    def ref():
+        return "%s%d" % (rnd.choice("ABCDEFGH"), rnd.randint(1, 1000))
+
+    formulas = []
+    for _ in range(count):
+        formula = rnd.choice(templates).format(
+            r="{r}", n=round(rnd.uniform(0, 100), 2), i=rnd.randint(1, 4), s="x" * rnd.randint(0, 20))
+        while "{r}" in formula:
+            formula = formula.replace("{r}", ref(), 1)
+        formulas.append(formula)
+    return formulas
+
+
+def best_of(fn, repeat):
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        fn()
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file", nargs="?", help="file with one formula per line")
+    parser.add_argument("--count", type=int, default=200000, help="number of formulas to make up (default 200000)")
+    parser.add_argument("--threads", default="1,2,4,0", help="thread counts for tokenize_many, 0 for one per CPU")
+    parser.add_argument("--repeat", type=int, default=3, help="runs of each, reporting the fastest (default 3)")
+    args = parser.parse_args()
+
+    if args.file:
+        with open(args.file, encoding="utf-8") as f:
+            formulas = [line.rstrip("\n") for line in f if line.strip()]
+    else:
+        formulas = make_formulas(args.count)
+
+    def loop():
+        result = []
+        for formula in formulas:
+            try:
+                result.append(tokenize(formula))
+            except RuntimeError:
+                result.append(None)
+        return result
+
+    chars = sum(len(f) for f in formulas)
+    print("%d formulas, %d characters" % (len(formulas), chars))
+
+    baseline = best_of(loop, args.repeat)
+    print("%-24s %8.3f s  %10.0f formulas/s" % ("tokenize loop", baseline, len(formulas) / baseline))
+
+    for threads in (int(t) for t in args.threads.split(",")):
+        elapsed = best_of(lambda: tokenize_many(formulas, threads=threads), args.repeat)
+        print("%-24s %8.3f s  %10.0f formulas/s  %5.1fx" % (
+            "tokenize_many(threads=%d)" % threads, elapsed, len(formulas) / elapsed, baseline / elapsed))
+
+
+if __name__ == "__main__":
+    main()
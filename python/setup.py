@@ -7,24 +7,34 @@ import sys
 import os
 
 
+# Headers used by the extension
+HEADERS = ["xlfparser.h", "xlfparser_parallel.h"]
+
+
 class sdist(_sdist):
-    """Custom sdist command to include the xlfparser header."""
+    """Custom sdist command to include the xlfparser headers."""
 
     def run(self):
-        # Copy the xlfparser.h file from the parent folder
-        src = Path(__file__).parent.parent / "include" / "xlfparser.h"
-        if src.exists():
-            dst = Path(__file__).parent / "include" / "xlfparser.h"
-            os.makedirs(dst.parent, exist_ok=True)
-            shutil.copyfile(src, dst)
+        # Copy the xlfparser headers from the parent folder
+        for header in HEADERS:
+            src = Path(__file__).parent.parent / "include" / header
+            if src.exists():
+                dst = Path(__file__).parent / "include" / header
+                os.makedirs(dst.parent, exist_ok=True)
+                shutil.copyfile(src, dst)
 
         return super().run()
 
 
 extra_compile_args = []
+extra_link_args = []
 
 if sys.platform == "win32":
     extra_compile_args.append("/std:c++17")
+else:
+    # tokenize_many runs on native threads
+    extra_compile_args.append("-pthread")
+    extra_link_args.append("-pthread")
 
 
 # The include folder is either in the current folder if building from the sdist
@@ -43,7 +53,8 @@ extensions = [
         include_dirs=[
             str(include_dir)
         ],
-        extra_compile_args=extra_compile_args
+        extra_compile_args=extra_compile_args,
+        extra_link_args=extra_link_args
     )
 ]
 
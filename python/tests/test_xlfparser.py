@@ -120,3 +120,118 @@ def test_with_options():
 
     with use_options(list_separator="|"):
         assert stringify(tokens) == "=FUNC(1|2|3)"
+
+
+def test_operand_subtypes():
+    tokens = tokenize("=IF(TRUE,TaxRate*A1#,B2)")
+    assert tokens[1].sub_type == Token.SubType.Logical
+    assert tokens[3].value == "TaxRate"
+    assert tokens[3].sub_type == Token.SubType.Name
+    assert tokens[5].value == "A1#"
+    assert tokens[5].sub_type == Token.SubType.Spill
+    assert tokens[7].sub_type == Token.SubType.Range
+
+
+def test_without_leading_equals():
+    tokens = tokenize("SUM(A1,2)", leading_equals=False)
+    assert [t.value for t in tokens] == ["SUM", "A1", ",", "2", ")"]
+    assert stringify(tokens) == "=SUM(A1,2)"
+
+    with use_options(leading_equals=False):
+        assert len(tokenize("A1+1")) == 3
+
+    with pytest.raises(RuntimeError):
+        tokenize("A1+1")
+
+
+def test_non_ascii_formulas():
+    # Strings stored with 1, 2 and 4 bytes per character
+    for text in ("café", "中文", "\U0001F600"):
+        formula = "=IF('%s'!A1>=1,\"%s\",%s)" % (text, text, text)
+        tokens = tokenize(formula)
+        assert [t.value for t in tokens] == ["IF", "'%s'!A1" % text, ">=", "1", ",", "\"%s\"" % text, ",", text, ")"]
+        assert tokens[7].sub_type == Token.SubType.Name
+
+    # Separators that don't fit in the formula's storage
+    tokens = tokenize("=SUM(1•2)", list_separator="•")
+    assert [t.value for t in tokens] == ["SUM", "1", "•", "2", ")"]
+    assert tokens[2].type == Token.Type.Argument
+
+
+def test_token_list():
+    from collections.abc import Sequence
+    from xlfparser import TokenList
+
+    tokens = tokenize("=SUM(A1:B2,C3)*2")
+    assert isinstance(tokens, TokenList)
+    assert isinstance(tokens, Sequence)
+    assert tokens.formula == "=SUM(A1:B2,C3)*2"
+
+    assert len(tokens) == 7
+    assert tokens[-1] == Token(value="2", type=Token.Type.Operand, sub_type=Token.SubType.Number)
+    assert [t.value for t in tokens[1:4]] == ["A1:B2", ",", "C3"]
+    assert list(tokens) == tokens[:]
+
+    # Fields can be read without creating a Token
+    assert tokens.type(0) == Token.Type.Function
+    assert tokens.sub_type(1) == Token.SubType.Range
+    assert tokens.value(-3) == ")"
+    functions = sum(1 for i in range(len(tokens))
+                    if tokens.type(i) == Token.Type.Function and tokens.sub_type(i) == Token.SubType.Start)
+    assert functions == 1
+
+    with pytest.raises(IndexError):
+        tokens[7]
+    with pytest.raises(IndexError):
+        tokens.type(-8)
+    with pytest.raises(TypeError):
+        TokenList()
+
+
+def test_tokenize_many():
+    from xlfparser import tokenize_many
+
+    formulas = ["=SUM(A1:B2)*2", "=)", "=\"café\"&A1", "=\"中文\"&B2", "=\"\U0001F600\"", "=1+2"] * 50
+    expected = [None if f == "=)" else list(tokenize(f)) for f in formulas]
+
+    for threads in (0, 1, 4):
+        result = tokenize_many(formulas, threads=threads)
+        assert [None if r is None else list(r) for r in result] == expected
+
+    # Any iterable of strings, with the same options as tokenize
+    result = tokenize_many((f for f in ["SUM(1;2)", "A1•B1"]), leading_equals=False, list_separator=";")
+    assert [t.value for t in result[0]] == ["SUM", "1", ";", "2", ")"]
+    assert result[0].formula == "SUM(1;2)"
+    assert len(result[1]) == 1
+
+    result = tokenize_many(["=SUM(1•2)"], list_separator="•")
+    assert result[0].type(2) == Token.Type.Argument
+
+    assert tokenize_many([]) == []
+
+    with pytest.raises(TypeError):
+        tokenize_many(["=1", 2])
+    with pytest.raises(ValueError):
+        tokenize_many(["=1"], threads=-1)
+
+
+def test_token_buffer():
+    import struct
+
+    tokens = tokenize("=SUM(A1,2)")
+    view = memoryview(tokens)
+    assert view.readonly
+    assert view.shape == (5,)
+    assert view.format == "T{Q:start:Q:end:i:type:i:subtype:}"
+
+    fields = list(struct.iter_unpack("QQii", view.tobytes()))
+    assert fields[1] == (5, 6, Token.Type.Operand.value, Token.SubType.Range.value)
+    assert [tokens.formula[start:end + 1] for start, end, _, _ in fields] == [t.value for t in tokens]
+
+    assert memoryview(tokenize("=1")).nbytes == view.itemsize
+
+    np = pytest.importorskip("numpy")
+    array = np.asarray(tokens)
+    assert array.dtype.names == ("start", "end", "type", "subtype")
+    assert (array["type"] == Token.Type.Function.value).sum() == 2
+    assert list(np.frombuffer(tokens, dtype=array.dtype)["end"]) == [3, 6, 7, 8, 9]
@@ -1,4 +1,4 @@
-from ._xlfparser import tokenize
+from ._xlfparser import tokenize, tokenize_many, TokenList
 from .token import Token, TokenVisitor, stringify
 from .ast import build_ast, Node, NodeVisitor
 from .options import use_options
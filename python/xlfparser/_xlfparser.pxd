@@ -1,16 +1,16 @@
 # distutils: language = c++
 
-from libc.stddef cimport wchar_t
 from libcpp.optional cimport optional
 from libcpp.vector cimport vector
 
 
-cdef extern from "<string>" namespace "std":
-    cdef cppclass wstring:
-        wstring() except +
-        wstring(wchar_t*, size_t) except +
-        const wchar_t* c_str() except +
-        size_t size() except +
+cdef extern from "<string_view>" namespace "std":
+    ctypedef unsigned short char16_t "char16_t"
+    ctypedef unsigned int char32_t "char32_t"
+
+    cdef cppclass basic_string_view[T]:
+        basic_string_view() noexcept
+        basic_string_view(const T*, size_t) noexcept
 
 
 cdef extern from "xlfparser.h" namespace "xlfparser::Token":
@@ -48,6 +48,8 @@ cdef extern from "xlfparser.h" namespace "xlfparser::Token::Subtype":
     cdef _Subtype Concatenation
     cdef _Subtype Intersection
     cdef _Subtype Union
+    cdef _Subtype Name
+    cdef _Subtype Spill
 
 
 cdef extern from "xlfparser.h" namespace "xlfparser":
@@ -60,10 +62,36 @@ cdef extern from "xlfparser.h" namespace "xlfparser":
         optional[T] list_separator
         optional[T] decimal_separator
         optional[T] row_separator
+        bint leading_equals
 
     cdef cppclass _Token "xlfparser::Token":
-        wstring value(const wstring& string) except +
+        size_t start() noexcept
+        size_t end() noexcept
         _Type type() noexcept
         _Subtype subtype() noexcept
 
-    vector[_Token] _tokenize "xlfparser::tokenize" (const wstring &formula, const _Options[wchar_t]& options) except + 
+    # Instantiated for the 1, 2 and 4 byte storage of Python strings
+    vector[_Token] _tokenize "xlfparser::tokenize" [T](const T* formula, size_t size, const _Options[T]& options) except +
+
+    cdef cppclass _Status "xlfparser::TokenBatch::Status":
+        pass
+
+    cdef _Status StatusOk "xlfparser::TokenBatch::Status::Ok"
+
+    cdef cppclass _TokenBatch "xlfparser::TokenBatch":
+        vector[_Token] tokens
+        vector[size_t] offsets
+        vector[_Status] status
+        size_t size() noexcept
+
+
+cdef extern from "xlfparser_parallel.h" namespace "xlfparser":
+
+    cdef cppclass _ThreadPool "xlfparser::ThreadPool":
+        _ThreadPool(size_t threads) except +
+        size_t size() noexcept
+
+    _TokenBatch _tokenize_batch "xlfparser::tokenize_batch" [T](_ThreadPool& pool,
+                                                                const basic_string_view[T]* formulas,
+                                                                size_t count,
+                                                                const _Options[T]& options) except + nogil
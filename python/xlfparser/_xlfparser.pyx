@@ -1,125 +1,359 @@
 # distutils: language = c++
 
-from ._xlfparser cimport _Token, _Type, _Subtype, _Options, _tokenize
+from ._xlfparser cimport (_Token, _Type, _Subtype, _Options, _tokenize, _TokenBatch, _ThreadPool, _tokenize_batch,
+                          StatusOk, basic_string_view, char16_t, char32_t)
 from .token import Token
 from .options import OptionsKwargs, Options
 
-from cython.operator import dereference
-from libc.stddef cimport wchar_t
-from libcpp.optional cimport optional
+from collections.abc import Sequence
+
+cimport cython
+from cpython.buffer cimport PyBUF_WRITABLE, PyBUF_FORMAT, PyBUF_ND, PyBUF_STRIDES
+from cpython.mem cimport PyMem_Free
+from cpython.unicode cimport (PyUnicode_KIND, PyUnicode_DATA, PyUnicode_Substring, PyUnicode_AsUCS4Copy,
+                              PyUnicode_1BYTE_KIND, PyUnicode_2BYTE_KIND, PyUnicode_4BYTE_KIND)
+from libc.stdint cimport uint8_t, uint16_t, uint32_t
 from libcpp.vector cimport vector
 
 
-cdef extern from "Python.h":
-     # Not wrapped by cython as a default
-     wchar_t* PyUnicode_AsWideCharString(object o, Py_ssize_t* size) except NULL
-     object PyUnicode_FromWideChar(const wchar_t *w, Py_ssize_t size)
-
-
-cdef wstring _to_wstring(s):
-    cdef Py_ssize_t size;
-    cdef wchar_t* wstr = PyUnicode_AsWideCharString(s, &size)
-    return wstring(wstr, size)
-
-
-cdef object _from_wstring(wstring s):
-    return PyUnicode_FromWideChar(s.c_str(), s.size())
-
-
-cdef object _from_type(_Type t):
-    if <int>t == <int>Unknown:
-        return Token.Type.Unknown
-    elif <int>t == <int>Operand:
-        return Token.Type.Operand
-    elif <int>t == <int>Function:
-        return Token.Type.Function
-    elif <int>t == <int>Array:
-        return Token.Type.Array
-    elif <int>t == <int>ArrayRow:
-        return Token.Type.ArrayRow
-    elif <int>t == <int>Subexpression:
-        return Token.Type.Subexpression
-    elif <int>t == <int>Argument:
-        return Token.Type.Argument
-    elif <int>t == <int>OperatorPrefix:
-        return Token.Type.OperatorPrefix
-    elif <int>t == <int>OperatorInfix:
-        return Token.Type.OperatorInfix
-    elif <int>t == <int>OperatorPostfix:
-        return Token.Type.OperatorPostfix
-    elif <int>t == <int>Whitespace:
-        return Token.Type.Whitespace
-    raise ValueError("Unexpected token type")
-
-
-cdef object _from_subtype(_Subtype st):
-    if <int>st == <int>_None:
-        return Token.SubType._None
-    elif <int>st == <int>Start:
-        return Token.SubType.Start
-    elif <int>st == <int>Stop:
-        return Token.SubType.Stop
-    elif <int>st == <int>Text:
-        return Token.SubType.Text
-    if <int>st == <int>Number:
-        return Token.SubType.Number
-    elif <int>st == <int>Logical:
-        return Token.SubType.Logical
-    elif <int>st == <int>Error:
-        return Token.SubType.Error
-    elif <int>st == <int>Range:
-        return Token.SubType.Range
-    if <int>st == <int>Math:
-        return Token.SubType.Math
-    elif <int>st == <int>Concatenation:
-        return Token.SubType.Concatenation
-    elif <int>st == <int>Intersection:
-        return Token.SubType.Intersection
-    elif <int>st == <int>Union:
-        return Token.SubType.Union
-    raise ValueError("Unexpected token subtype")
-
-
-cdef wchar_t _get_option(options, key):
+# The storage of a Python str, depending on its largest character (PEP 393)
+ctypedef fused _char_type:
+    uint8_t
+    uint16_t
+    uint32_t
+
+
+# The same storage as standard character types, for string views
+ctypedef fused _view_char_type:
+    char
+    char16_t
+    char32_t
+
+
+ctypedef fused _any_char_type:
+    uint8_t
+    uint16_t
+    uint32_t
+    char
+    char16_t
+    char32_t
+
+
+# Buffer format of a Token, checked against the C++ layout when the module is imported
+cdef char* _TOKEN_FORMAT = b"T{Q:start:Q:end:i:type:i:subtype:}" if sizeof(size_t) == 8 \
+                           else b"T{I:start:I:end:i:type:i:subtype:}"
+
+if sizeof(_Token) != 2 * sizeof(size_t) + 2 * sizeof(int) or sizeof(_Type) != sizeof(int):
+    raise ImportError("Unexpected layout of xlfparser::Token")
+
+
+# Token.Type and Token.SubType have the same values as the C++ enums, so are looked up by value
+cdef tuple _TYPES = tuple(Token.Type)
+cdef tuple _SUBTYPES = tuple(Token.SubType)
+
+
+cdef inline object _from_type(_Type t):
+    return _TYPES[<int>t]
+
+
+cdef inline object _from_subtype(_Subtype st):
+    return _SUBTYPES[<int>st]
+
+
+cdef Py_UCS4 _get_option(options, key) except? 0:
     value = getattr(options, key)
     if not isinstance(value, str) or len(value) != 1:
         raise ValueError("Unexpected value '%s' for '%s'" % (value, key))
-    cdef wstring wvalue = _to_wstring(value)
-    return dereference(wvalue.c_str())
+    return ord(value)
+
+
+cdef class _CharOptions:
+    """Options converted to characters once, for use with any storage width."""
+    cdef Py_UCS4 left_brace
+    cdef Py_UCS4 right_brace
+    cdef Py_UCS4 left_bracket
+    cdef Py_UCS4 right_bracket
+    cdef Py_UCS4 list_separator
+    cdef Py_UCS4 decimal_separator
+    cdef Py_UCS4 row_separator
+    cdef bint leading_equals
+    cdef Py_UCS4 max_char
+
+    def __init__(self, kwargs):
+        options = Options.from_kwargs(**kwargs)
+        self.left_brace = _get_option(options, "left_brace")
+        self.right_brace = _get_option(options, "right_brace")
+        self.left_bracket = _get_option(options, "left_bracket")
+        self.right_bracket = _get_option(options, "right_bracket")
+        self.list_separator = _get_option(options, "list_separator")
+        self.decimal_separator = _get_option(options, "decimal_separator")
+        self.row_separator = _get_option(options, "row_separator")
+        self.leading_equals = bool(options.leading_equals)
+        self.max_char = max(self.left_brace, self.right_brace, self.left_bracket, self.right_bracket,
+                            self.list_separator, self.decimal_separator, self.row_separator)
+
+
+cdef void _set_options(_Options[_any_char_type]* coptions, _CharOptions options) noexcept:
+    coptions.left_brace = <_any_char_type>options.left_brace
+    coptions.right_brace = <_any_char_type>options.right_brace
+    coptions.left_bracket = <_any_char_type>options.left_bracket
+    coptions.right_bracket = <_any_char_type>options.right_bracket
+    coptions.list_separator = <_any_char_type>options.list_separator
+    coptions.decimal_separator = <_any_char_type>options.decimal_separator
+    coptions.row_separator = <_any_char_type>options.row_separator
+    coptions.leading_equals = options.leading_equals
+
+
+cdef vector[_Token] _tokenize_data(const _char_type* data, Py_ssize_t size, _CharOptions options):
+    cdef _Options[_char_type] coptions
+    _set_options(&coptions, options)
+    return _tokenize(data, size, coptions)
+
+
+cdef vector[_Token] _tokenize_str(str formula, _CharOptions options):
+    """Tokenize a str in place, without converting it to another representation."""
+    cdef unsigned int kind = PyUnicode_KIND(formula)
+    cdef Py_ssize_t size = len(formula)
+    cdef void* data = PyUnicode_DATA(formula)
+    cdef Py_UCS4* wide
+
+    # Options that can't be stored in the same width as the formula need it widening
+    if (kind == PyUnicode_1BYTE_KIND and options.max_char > 0xFF) \
+            or (kind == PyUnicode_2BYTE_KIND and options.max_char > 0xFFFF):
+        wide = PyUnicode_AsUCS4Copy(formula)
+        try:
+            return _tokenize_data(<const uint32_t*>wide, size, options)
+        finally:
+            PyMem_Free(wide)
+
+    if kind == PyUnicode_1BYTE_KIND:
+        return _tokenize_data(<const uint8_t*>data, size, options)
+    elif kind == PyUnicode_2BYTE_KIND:
+        return _tokenize_data(<const uint16_t*>data, size, options)
+    return _tokenize_data(<const uint32_t*>data, size, options)
+
+
+@cython.final
+cdef class TokenList:
+    """Tokens returned by tokenize.
+
+    Behaves like a read-only list of Token objects, but keeps the tokens in their C++
+    form and only creates a Token, and its value, when it's accessed. type, sub_type
+    and value get a single field of a token without creating the Token.
+
+    The tokens can also be read without copying through the buffer protocol, as an
+    array of (start, end, type, subtype) structs with end inclusive and type and
+    subtype the values of Token.Type and Token.SubType, eg. with memoryview or
+    numpy.asarray.
+    """
+    cdef vector[_Token] _tokens
+    cdef str _formula
+    cdef Py_ssize_t _shape[1]
+    cdef Py_ssize_t _strides[1]
+
+    def __init__(self):
+        raise TypeError("TokenList objects are returned by tokenize")
 
+    @staticmethod
+    cdef TokenList _create(str formula, vector[_Token]& tokens):
+        cdef TokenList self = TokenList.__new__(TokenList)
+        self._formula = formula
+        self._tokens.swap(tokens)
+        return self
 
-cdef _Options[wchar_t] _to_options(object kwargs):
-    cdef _Options[wchar_t] coptions
-    options = Options.from_kwargs(**kwargs)
-    coptions.left_brace = _get_option(options, "left_brace")
-    coptions.right_brace = _get_option(options, "right_brace")
-    coptions.left_bracket = _get_option(options, "left_bracket")
-    coptions.right_bracket = _get_option(options, "right_bracket")
-    coptions.list_separator = _get_option(options, "list_separator")
-    coptions.decimal_separator = _get_option(options, "decimal_separator")
-    coptions.row_separator = _get_option(options, "row_separator")
-    return coptions
+    @staticmethod
+    cdef TokenList _from_range(str formula, const _Token* first, const _Token* last):
+        cdef TokenList self = TokenList.__new__(TokenList)
+        self._formula = formula
+        self._tokens.assign(first, last)
+        return self
+
+    cdef Py_ssize_t _index(self, Py_ssize_t index) except -1:
+        cdef Py_ssize_t size = self._tokens.size()
+        if index < 0:
+            index += size
+        if index < 0 or index >= size:
+            raise IndexError("token index out of range")
+        return index
+
+    cdef object _token(self, Py_ssize_t index):
+        cdef _Token* token = &self._tokens[index]
+        return Token(
+            value=PyUnicode_Substring(self._formula, token.start(), token.end() + 1),
+            type=_TYPES[<int>token.type()],
+            sub_type=_SUBTYPES[<int>token.subtype()]
+        )
+
+    @property
+    def formula(self):
+        """The formula the tokens were taken from."""
+        return self._formula
+
+    def type(self, Py_ssize_t index):
+        """Token.Type of the token at index."""
+        return _from_type(self._tokens[self._index(index)].type())
+
+    def sub_type(self, Py_ssize_t index):
+        """Token.SubType of the token at index."""
+        return _from_subtype(self._tokens[self._index(index)].subtype())
+
+    def value(self, Py_ssize_t index):
+        """Text of the token at index."""
+        cdef _Token* token = &self._tokens[self._index(index)]
+        return PyUnicode_Substring(self._formula, token.start(), token.end() + 1)
+
+    def __len__(self):
+        return self._tokens.size()
+
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            return [self._token(i) for i in range(*index.indices(self._tokens.size()))]
+        return self._token(self._index(index))
+
+    def __iter__(self):
+        cdef size_t i
+        for i in range(self._tokens.size()):
+            yield self._token(i)
+
+    def __repr__(self):
+        return "TokenList(%r)" % list(self)
+
+    def __getbuffer__(self, Py_buffer* buffer, int flags):
+        if flags & PyBUF_WRITABLE:
+            raise BufferError("TokenList is read-only")
+
+        self._shape[0] = self._tokens.size()
+        self._strides[0] = sizeof(_Token)
+
+        buffer.buf = self._tokens.data()
+        buffer.obj = self
+        buffer.len = self._tokens.size() * sizeof(_Token)
+        buffer.itemsize = sizeof(_Token)
+        buffer.readonly = 1
+        buffer.ndim = 1
+        buffer.format = NULL
+        buffer.shape = NULL
+        buffer.strides = NULL
+        buffer.suboffsets = NULL
+        if flags & PyBUF_FORMAT:
+            buffer.format = _TOKEN_FORMAT
+        if flags & PyBUF_ND:
+            buffer.shape = self._shape
+        if flags & PyBUF_STRIDES:
+            buffer.strides = self._strides
+        buffer.internal = NULL
+
+    def __releasebuffer__(self, Py_buffer* buffer):
+        pass
+
+
+Sequence.register(TokenList)
 
 
 def tokenize(str formula, **kwargs: OptionsKwargs):
-    cdef _Options[wchar_t] options = _to_options(kwargs)
-    cdef wstring wformula = _to_wstring(formula)
-    cdef vector[_Token] tokens = _tokenize(wformula, options)
+    cdef _CharOptions options = _CharOptions(kwargs)
+    cdef vector[_Token] tokens = _tokenize_str(formula, options)
+    return TokenList._create(formula, tokens)
 
-    cdef wstring value
-    cdef _Type type
-    cdef _Subtype sub_type
+
+cdef _TokenBatch _tokenize_views(_ThreadPool* pool,
+                                 vector[basic_string_view[_view_char_type]]& views,
+                                 _CharOptions options):
+    cdef _Options[_view_char_type] coptions
+    cdef _TokenBatch batch
+    _set_options(&coptions, options)
+    with nogil:
+        batch = _tokenize_batch(pool[0], views.data(), views.size(), coptions)
+    return batch
+
+
+def tokenize_many(formulas, Py_ssize_t threads=0, **kwargs: OptionsKwargs):
+    """Tokenize many formulas at once on native threads.
+
+    The formulas are tokenized in place without holding the GIL, using ``threads``
+    threads, or one per CPU if it's 0. Returns a list with a TokenList for each
+    formula, or None for any formula that's invalid.
+    """
+    if threads < 0:
+        raise ValueError("threads must not be negative")
+
+    cdef _CharOptions options = _CharOptions(kwargs)
+
+    # Keeps the strings alive while the GIL is released
+    formulas = list(formulas)
+
+    # Formulas are grouped by the width of their storage, with each group tokenized as
+    # a batch of string views onto the formulas' own data. groups[i] and indexes[i] are
+    # where formula i is in the groups.
+    cdef vector[basic_string_view[char]] views1
+    cdef vector[basic_string_view[char16_t]] views2
+    cdef vector[basic_string_view[char32_t]] views4
+    cdef vector[uint8_t] groups
+    cdef vector[size_t] indexes
+    cdef vector[Py_UCS4*] copies
+    cdef _TokenBatch batches[5]
+    cdef _ThreadPool* pool = NULL
+    cdef unsigned int kind
+    cdef Py_ssize_t size
+    cdef void* data
+    cdef Py_UCS4* wide
+
+    groups.reserve(len(formulas))
+    indexes.reserve(len(formulas))
+
+    try:
+        for formula in formulas:
+            if not isinstance(formula, str):
+                raise TypeError("Expected str, got '%s'" % type(formula).__name__)
+
+            kind = PyUnicode_KIND(formula)
+            size = len(formula)
+            data = PyUnicode_DATA(formula)
+
+            # Options that can't be stored in the same width as the formula need it widening
+            if (kind == PyUnicode_1BYTE_KIND and options.max_char > 0xFF) \
+                    or (kind == PyUnicode_2BYTE_KIND and options.max_char > 0xFFFF):
+                wide = PyUnicode_AsUCS4Copy(formula)
+                copies.push_back(wide)
+                kind = PyUnicode_4BYTE_KIND
+                data = wide
+
+            groups.push_back(kind)
+            if kind == PyUnicode_1BYTE_KIND:
+                indexes.push_back(views1.size())
+                views1.push_back(basic_string_view[char](<const char*>data, size))
+            elif kind == PyUnicode_2BYTE_KIND:
+                indexes.push_back(views2.size())
+                views2.push_back(basic_string_view[char16_t](<const char16_t*>data, size))
+            else:
+                indexes.push_back(views4.size())
+                views4.push_back(basic_string_view[char32_t](<const char32_t*>data, size))
+
+        pool = new _ThreadPool(threads)
+        if not views1.empty():
+            batches[PyUnicode_1BYTE_KIND] = _tokenize_views(pool, views1, options)
+        if not views2.empty():
+            batches[PyUnicode_2BYTE_KIND] = _tokenize_views(pool, views2, options)
+        if not views4.empty():
+            batches[PyUnicode_4BYTE_KIND] = _tokenize_views(pool, views4, options)
+    finally:
+        del pool
+        for wide in copies:
+            PyMem_Free(wide)
+
+    cdef _TokenBatch* batch
+    cdef const _Token* tokens
+    cdef size_t i, j
 
     result = []
-    for i in range(tokens.size()):
-        value = tokens[i].value(wformula)
-        type = tokens[i].type()
-        sub_type = tokens[i].subtype()
-
-        result.append(Token(
-            value=_from_wstring(value),
-            type=_from_type(type),
-            sub_type=_from_subtype(sub_type)
-        ))
+    for i in range(groups.size()):
+        batch = &batches[groups[i]]
+        j = indexes[i]
+        if <int>batch.status[j] != <int>StatusOk:
+            result.append(None)
+            continue
+
+        tokens = batch.tokens.data()
+        result.append(TokenList._from_range(formulas[i], tokens + batch.offsets[j], tokens + batch.offsets[j + 1]))
 
     return result
@@ -11,6 +11,7 @@ class OptionsKwargs(TypedDict):
     list_separator: str
     decimal_separator: str
     row_separator: str
+    leading_equals: bool
 
 
 @dataclass
@@ -22,6 +23,7 @@ class Options:
     list_separator: str
     decimal_separator: str
     row_separator: str
+    leading_equals: bool
 
     class Defaults:
         left_brace = "{"
@@ -31,12 +33,18 @@ class Options:
         list_separator = ","
         decimal_separator = "."
         row_separator = ";"
+        leading_equals = True
 
     _user_defaults = {}
 
     @classmethod
     def __get_option(cls, option, kwargs: OptionsKwargs):
-        return kwargs.get(option) or cls._user_defaults.get(option) or getattr(cls.Defaults, option)
+        # Not using 'or' as False is a valid value for boolean options
+        for source in (kwargs, cls._user_defaults):
+            value = source.get(option)
+            if value is not None and value != "":
+                return value
+        return getattr(cls.Defaults, option)
 
     @classmethod
     def from_kwargs(cls, **kwargs: OptionsKwargs):
@@ -48,6 +56,7 @@ class Options:
             list_separator=cls.__get_option("list_separator", kwargs),
             decimal_separator=cls.__get_option("decimal_separator", kwargs),
             row_separator=cls.__get_option("row_separator", kwargs),
+            leading_equals=cls.__get_option("leading_equals", kwargs),
         )
 
 
@@ -34,6 +34,8 @@ class Token:
         Concatenation = 9
         Intersection = 10
         Union = 11
+        Name = 12
+        Spill = 13
 
     value: str
     type: Type
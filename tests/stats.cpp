@@ -0,0 +1,111 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Tests for the counters collected when built with XLFP_STATS defined.
+// The main tests are built without it, so the counters are compiled out there.
+
+#include "catch.hpp"
+#include "xlfparser.h"
+#include <thread>
+
+using namespace xlfparser;
+
+
+static uint64_t count(const TokenizeStats& stats, Token::Type type)
+{
+    return stats.tokens[size_t(type)];
+}
+
+
+TEST_CASE("Characters are counted by tokenizer state", "[stats]")
+{
+    reset_tokenize_stats();
+
+    // The opening quote or bracket is scanned in the default state and
+    // the rest of the string, path, range or error in its own state
+    const std::string formula = "=\"abcdef\"&'My Sheet'!A1+Table1[[#All]]+#N/A";
+    tokenize(formula);
+
+    const auto stats = tokenize_stats();
+    CHECK(stats.chars_in_string == 7);
+    CHECK(stats.chars_in_path == 9);
+    CHECK(stats.chars_in_range == 7);
+    CHECK(stats.chars_in_error == 3);
+
+    // Every character after the '=' is counted once
+    CHECK(stats.chars_default + stats.chars_in_string + stats.chars_in_path +
+          stats.chars_in_range + stats.chars_in_error == formula.size() - 1);
+}
+
+
+TEST_CASE("Tokens, intersections and nesting are counted", "[stats]")
+{
+    reset_tokenize_stats();
+
+    tokenize(std::string("=SUM((A1:B2 B1:C3), {1,2;3,4}, 1.5E+3)"));
+
+    auto stats = tokenize_stats();
+    CHECK(count(stats, Token::Type::Function) == 2);
+    CHECK(count(stats, Token::Type::Subexpression) == 2);
+    CHECK(count(stats, Token::Type::Operand) == 7);
+    CHECK(count(stats, Token::Type::Whitespace) == 0);
+    CHECK(stats.intersections == 1);
+    CHECK(stats.max_depth == 3);
+    CHECK(stats.scientific_notation_checks > 0);
+
+    reset_tokenize_stats();
+    stats = tokenize_stats();
+    CHECK(stats.intersections == 0);
+    CHECK(count(stats, Token::Type::Function) == 0);
+}
+
+
+TEST_CASE("Counters from other threads are included", "[stats]")
+{
+    reset_tokenize_stats();
+
+    // Counters are kept after the threads exit
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+        threads.emplace_back([]() { tokenize(std::string("=A1 B1")); });
+    for (auto& thread : threads)
+        thread.join();
+
+    const auto stats = tokenize_stats();
+    CHECK(stats.intersections == 4);
+    CHECK(count(stats, Token::Type::Operand) == 8);
+    CHECK(stats.chars_default == 4 * 5);
+}
+
+
+TEST_CASE("Scientific notation is only checked at + and -", "[stats]")
+{
+    reset_tokenize_stats();
+
+    tokenize("=" + std::string(5000, '1'));
+    CHECK(tokenize_stats().scientific_notation_checks == 0);
+
+    tokenize(std::string("=1.5E+3-2"));
+    CHECK(tokenize_stats().scientific_notation_checks == 2);
+}
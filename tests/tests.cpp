@@ -23,6 +23,19 @@ THE SOFTWARE.
 */
 #include "catch.hpp"
 #include "xlfparser.h"
+#include "xlfparser_arrow.h"
+#include "xlfparser_cache.h"
+#include "xlfparser_corpus.h"
+#include "xlfparser_generator.h"
+#include "xlfparser_parallel.h"
+#include "xlfparser_sheetxml.h"
+#include "xlfparser_tokenfile.h"
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <thread>
 
 using namespace Catch::Matchers;
 using namespace xlfparser;
@@ -70,6 +83,37 @@ TEST_CASE("Wide formula can be parsed correctly", "[xlfparser]")
 }
 
 
+TEST_CASE("Formulas stored as code points of any width can be parsed", "[xlfparser]")
+{
+    // As in the 1, 2 and 4 byte storage of Python strings
+    const std::u32string formula = U"=IF(A1>=1.5E+3,\"\u00e9t\u00e9 \u4e2d\U0001F600\",#N/A)&'\u00c9t\u00e9'!B2";
+    const auto expected = tokenize(std::wstring(formula.begin(), formula.end()));
+    REQUIRE(expected.size() == 11);
+
+    auto check_width = [&](auto c) {
+        using char_type = decltype(c);
+        std::vector<char_type> chars;
+        for (auto cp : formula)
+            chars.push_back(cp <= std::numeric_limits<char_type>::max() ? static_cast<char_type>(cp) : char_type('?'));
+
+        CHECK(tokenize(chars.data(), chars.size()) == expected);
+    };
+
+    check_width(uint32_t());
+    check_width(uint16_t());
+    check_width(uint8_t());
+
+    Options<uint16_t> options;
+    options.list_separator = ';';
+    options.decimal_separator = ',';
+    const std::u16string locale = u"=SUM(1,5;\u00e9)";
+    const auto tokens = tokenize(reinterpret_cast<const uint16_t*>(locale.data()), locale.size(), options);
+    REQUIRE(tokens.size() == 5);
+    CHECK(tokens[1].subtype() == Token::Subtype::Number);
+    CHECK(tokens[1].end() - tokens[1].start() == 2);
+}
+
+
 TEST_CASE("Formula including a function parses correctly", "[xlfparser]")
 {
     std::string formula("=SUM(1,2)");
@@ -441,6 +485,1154 @@ TEST_CASE("Invalid formula expressions throw an exception", "[xlfparser]")
 {
     REQUIRE_THROWS_WITH(tokenize(std::string_view("=}")), Contains("Mismatched braces"));
     REQUIRE_THROWS_WITH(tokenize(std::string_view("={1,2,3}}")), Contains("Mismatched braces"));
+    REQUIRE_THROWS_WITH(tokenize(std::string_view("=SUM(}")), Contains("Mismatched braces"));
     REQUIRE_THROWS_WITH(tokenize(std::string_view("=)")), Contains("Mismatched parentheses"));
     REQUIRE_THROWS_WITH(tokenize(std::string_view("=foo())")), Contains("Mismatched parentheses"));
 }
+
+
+TEST_CASE("Copied formulas have the same fingerprint", "[xlfparser]")
+{
+    // =A1+B1 in C1 copied down to C2
+    CHECK(fingerprint(std::string("=A1+B1"), 1, 3) == fingerprint(std::string("=A2+B2"), 2, 3));
+
+    // absolute references are not shifted when copied
+    CHECK(fingerprint(std::string("=$A$1*B1"), 1, 3) == fingerprint(std::string("=$A$1*B2"), 2, 3));
+    CHECK(fingerprint(std::string("=$A$1"), 1, 3) != fingerprint(std::string("=$A$2"), 2, 3));
+    CHECK(fingerprint(std::string("=SUM($A1:A$10)"), 1, 3) == fingerprint(std::string("=SUM($A2:B$10)"), 2, 4));
+    CHECK(fingerprint(std::string("=SUM(A:A)"), 1, 2) == fingerprint(std::string("=SUM(B:B)"), 1, 3));
+
+    // whole rows, whole columns and single cells at the host cell are all different
+    CHECK(fingerprint(std::string("=SUM(B:B)"), 2, 2) != fingerprint(std::string("=SUM(B2:B2)"), 2, 2));
+    CHECK(fingerprint(std::string("=SUM(2:2)"), 2, 2) != fingerprint(std::string("=SUM(B2:B2)"), 2, 2));
+    CHECK(fingerprint(std::string("=SUM(A:A)"), 1, 1) != fingerprint(std::string("=SUM(1:1)"), 1, 1));
+    CHECK(fingerprint(std::string("=SUM(A:A)"), 1, 1) != fingerprint(std::string("=SUM(A1:A1)"), 1, 1));
+    CHECK(fingerprint(std::string("=SUM(1:1)"), 1, 1) != fingerprint(std::string("=SUM(A1:A1)"), 1, 1));
+    CHECK(fingerprint(std::string("=SUM($A:$A)"), 1, 1) != fingerprint(std::string("=SUM($1:$1)"), 1, 1));
+
+    // function names and references are case insensitive, strings are not
+    CHECK(fingerprint(std::string("=SUM(Sheet1!A1:A10)"), 1, 2) == fingerprint(std::string("=sum(SHEET1!a2:a11)"), 2, 2));
+    CHECK(fingerprint(std::string("=\"a\"&A1"), 1, 2) != fingerprint(std::string("=\"A\"&A1"), 1, 2));
+
+    // different operators and sheets give different fingerprints
+    CHECK(fingerprint(std::string("=A1+B1"), 1, 3) != fingerprint(std::string("=A1-B1"), 1, 3));
+    CHECK(fingerprint(std::string("=Sheet1!A1"), 1, 3) != fingerprint(std::string("=Sheet2!A1"), 1, 3));
+    CHECK(fingerprint(std::string("=A1"), 1, 3) != fingerprint(std::string("=A1"), 2, 3));
+
+    // the fingerprint doesn't depend on the character type or separators
+    CHECK(fingerprint(std::string("=SUM(A1,2.5)"), 1, 3) == fingerprint(std::wstring(L"=SUM(A1,2.5)"), 1, 3));
+    CHECK(fingerprint(std::string("=SUM(A1,B1)"), 1, 3) == fingerprint(std::string("=SUM(A1;B1)"), 1, 3, {
+        .list_separator = ';'
+    }));
+}
+
+
+TEST_CASE("Token cache returns shared tokens for repeated formulas", "[xlfparser]")
+{
+    TokenCache<char> cache(1 << 20, 4);
+    std::string formula("=SUM(A1:A10)");
+
+    auto tokens1 = cache.tokenize(formula);
+    auto tokens2 = cache.tokenize(formula);
+    REQUIRE(tokens1->size() == 3);
+    CHECK(tokens1 == tokens2);
+
+    // different options are cached separately
+    auto tokens3 = cache.tokenize(formula, {.list_separator = ';'});
+    CHECK(tokens1 != tokens3);
+
+    auto stats = cache.stats();
+    CHECK(stats.hits == 1);
+    CHECK(stats.misses == 2);
+    CHECK(stats.evictions == 0);
+    CHECK(stats.entries == 2);
+    CHECK(stats.bytes > 0);
+    CHECK(stats.bytes <= cache.capacity());
+
+    // invalid formulas are not cached
+    REQUIRE_THROWS_WITH(cache.tokenize(std::string_view("=)")), Contains("Mismatched parentheses"));
+    CHECK(cache.stats().entries == 2);
+
+    cache.clear();
+    CHECK(cache.stats().entries == 0);
+    CHECK(cache.tokenize(formula) != tokens1);
+
+    // small caches use fewer shards rather than being too small to hold anything
+    TokenCache<char> small(4096);
+    CHECK(small.tokenize(formula) == small.tokenize(formula));
+    CHECK(small.stats().entries == 1);
+
+    // formulas of character types without a std::hash can be cached
+    TokenCache<char16_t> wide(4096);
+    const std::u16string wide_formula(formula.begin(), formula.end());
+    CHECK(*wide.tokenize(wide_formula) == *tokens1);
+    CHECK(wide.tokenize(wide_formula) == wide.tokenize(wide_formula));
+}
+
+
+TEST_CASE("Token cache evicts entries to stay within its capacity", "[xlfparser]")
+{
+    TokenCache<char> cache(2048, 1);
+
+    std::vector<std::string> formulas;
+    for (int i = 0; i < 100; ++i)
+        formulas.push_back("=A" + std::to_string(i) + "+1");
+
+    for (const auto& formula : formulas)
+        cache.tokenize(formula);
+
+    auto stats = cache.stats();
+    CHECK(stats.misses == 100);
+    CHECK(stats.evictions > 0);
+    CHECK(stats.entries + stats.evictions == 100);
+    CHECK(stats.bytes <= 2048);
+
+    // recently used entries survive eviction
+    auto hot = cache.tokenize(formulas.back());
+    for (int i = 0; i < 3; ++i)
+    {
+        cache.tokenize(formulas[i]);
+        CHECK(cache.tokenize(formulas.back()) == hot);
+    }
+}
+
+
+TEST_CASE("Token cache can be used from multiple threads", "[xlfparser]")
+{
+    TokenCache<wchar_t> cache(1 << 16);
+
+    std::vector<std::wstring> formulas;
+    for (int i = 0; i < 50; ++i)
+        formulas.push_back(L"=SUM(A" + std::to_wstring(i) + L":B10)*2");
+
+    std::vector<std::thread> threads;
+    std::atomic<size_t> errors{0};
+    for (int t = 0; t < 8; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 1000; ++i)
+            {
+                const auto& formula = formulas[(i * 7 + t) % formulas.size()];
+                if (cache.tokenize(formula)->size() != 5)
+                    ++errors;
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    auto stats = cache.stats();
+    CHECK(errors == 0);
+    CHECK(stats.hits + stats.misses == 8000);
+    CHECK(stats.entries <= formulas.size());
+}
+
+
+TEST_CASE("Tokens can be converted back into a formula", "[xlfparser]")
+{
+    std::string formula("=3*4+5");
+    CHECK_THAT(stringify(tokenize(formula), formula), Equals("=3*4+5"));
+
+    formula = "=-1%";
+    CHECK_THAT(stringify(tokenize(formula), formula), Equals("=-1%"));
+
+    formula = "=SUM(A1:A2) & \"a \"\"b\"\"\"";
+    CHECK_THAT(stringify(tokenize(formula), formula), Equals("=SUM(A1:A2)&\"a \"\"b\"\"\""));
+
+    formula = "={FUNC(-1, 2*3, 4%, (5 / 6));1,2,3}";
+    CHECK_THAT(stringify(tokenize(formula), formula), Equals("={FUNC(-1,2*3,4%,(5/6));1,2,3}"));
+    CHECK_THAT(stringify(tokenize(formula), formula, {.list_separator = '_'}), Equals("={FUNC(-1_2*3_4%_(5/6));1_2_3}"));
+
+    // intersections are kept
+    formula = "=SUM(A1:B2 B1:C2)";
+    CHECK_THAT(stringify(tokenize(formula), formula), Equals("=SUM(A1:B2 B1:C2)"));
+
+    std::wstring wformula(L"=IF(A1>=2,\"yes\",\"no\")");
+    CHECK(stringify(tokenize(wformula), wformula) == wformula);
+}
+
+
+TEST_CASE("Formulas can be converted between locales", "[xlfparser]")
+{
+    std::string formula("=SUM(1,5;2000,25;2,5E+10)+{1;2}");
+    auto tokens = tokenize(formula, {
+        .list_separator = ';',
+        .decimal_separator = ','
+    });
+
+    CHECK_THAT(stringify(tokens, formula), Equals("=SUM(1.5,2000.25,2.5E+10)+{1;2}"));
+    CHECK_THAT(stringify(tokens, std::string_view(formula), {.list_separator = ';', .decimal_separator = ','}),
+               Equals(formula));
+
+    // brackets are part of the references, so are kept as they were
+    formula = "=R(1)C(-1)+1,5";
+    tokens = tokenize(formula, {
+        .left_bracket = '(',
+        .right_bracket = ')',
+        .list_separator = ';',
+        .decimal_separator = ','
+    });
+
+    CHECK_THAT(stringify(tokens, formula), Equals("=R(1)C(-1)+1.5"));
+    CHECK_THAT(stringify(tokens, formula, {.left_bracket = '[', .right_bracket = ']'}), Equals("=R(1)C(-1)+1.5"));
+}
+
+
+TEST_CASE("Retokenizing after an edit matches tokenizing the edited formula", "[xlfparser]")
+{
+    std::vector<std::string> formulas{
+        "=SUM(A1:A10, B1 C1) + IF(A1>=2,\"a, \"\"b\"\" (c\",'My Sheet'!$A$1)",
+        "={1,2;3,4}*-2.5E+10%",
+        "=R[1]C[-1]&[Book1.xlsx]Sheet1!A1 & #N/A",
+        "=(A1:B2 (C1:D2)) - -1",
+    };
+
+    std::vector<std::string> inserts{"", "1", " ", ")", "\"", "'", ",", "-", "}", "["};
+
+    for (const auto& formula : formulas)
+    {
+        auto previous = tokenize(formula);
+
+        for (size_t offset = 1; offset <= formula.size(); ++offset)
+        {
+            for (size_t removed = 0; removed <= 1 && offset + removed <= formula.size(); ++removed)
+            {
+                for (const auto& insert : inserts)
+                {
+                    if (removed == 0 && insert.empty())
+                        continue;
+
+                    std::string edited = formula.substr(0, offset) + insert + formula.substr(offset + removed);
+                    INFO(edited);
+
+                    std::vector<Token> expected;
+                    try
+                    {
+                        expected = tokenize(edited);
+                    }
+                    catch (const invalid_formula&)
+                    {
+                        CHECK_THROWS_AS(retokenize(previous, edited, offset, removed, insert.size()), invalid_formula);
+                        continue;
+                    }
+
+                    CHECK(retokenize(previous, edited, offset, removed, insert.size()) == expected);
+                }
+            }
+        }
+    }
+}
+
+
+TEST_CASE("Token index finds matching tokens and function arguments", "[xlfparser]")
+{
+    std::string formula("=IF(A1>0,SUM(B1,(C1+D1)),VLOOKUP(E1,F1:G10,2,NOW()))");
+    auto tokens = tokenize(formula);
+    TokenIndex index(tokens);
+
+    REQUIRE(index.size() == tokens.size());
+    REQUIRE(tokens.size() == 26);
+
+    // IF( ... )
+    CHECK(index.partner(0) == 25);
+    CHECK(index.partner(25) == 0);
+    CHECK(index.depth(0) == 0);
+    CHECK(index.parent(0) == TokenIndex::npos);
+    CHECK(index.function(0) == TokenIndex::npos);
+    CHECK(index.argument_count(0) == 3);
+
+    // SUM(B1,(C1+D1)) is the second argument of IF
+    CHECK_THAT(tokens[5].value(formula), Equals("SUM"));
+    CHECK(index.function(5) == 0);
+    CHECK(index.argument(5) == 1);
+    CHECK(index.partner(5) == 13);
+    CHECK(index.argument_count(5) == 2);
+
+    // C1 is inside a subexpression in the second argument of SUM
+    CHECK_THAT(tokens[9].value(formula), Equals("C1"));
+    CHECK(index.depth(9) == 3);
+    CHECK(index.parent(9) == 8);
+    CHECK(index.function(9) == 5);
+    CHECK(index.argument(9) == 1);
+    CHECK(index.argument_tokens(5, 1) == std::make_pair<size_t, size_t>(8, 13));
+
+    // the third argument of VLOOKUP
+    CHECK_THAT(tokens[15].value(formula), Equals("VLOOKUP"));
+    auto arg = index.argument_tokens(15, 2);
+    REQUIRE(arg.second - arg.first == 1);
+    CHECK_THAT(tokens[arg.first].value(formula), Equals("2"));
+    CHECK(index.argument(arg.first) == 2);
+    CHECK(index.argument(arg.second) == 2);
+    CHECK(index.argument_count(15) == 4);
+
+    // NOW() has no arguments
+    CHECK(index.argument_count(22) == 0);
+    CHECK_THROWS_AS(index.argument_tokens(22, 0), std::out_of_range);
+
+    // arrays and array rows are matched too
+    formula = "={1,2;3,4}";
+    tokens = tokenize(formula);
+    TokenIndex array_index(tokens);
+    CHECK(array_index.partner(0) == tokens.size() - 1);
+    CHECK(array_index.partner(1) == 5);
+    CHECK(array_index.depth(2) == 2);
+    CHECK(array_index.function(2) == TokenIndex::npos);
+}
+
+
+TEST_CASE("Tokens can be found from an offset in the formula", "[xlfparser]")
+{
+    //                    0123456789012345678901234567
+    std::string formula("=SUM(A1, MAX(B1:B2)) + {1;2}");
+    auto tokens = tokenize(formula);
+    TokenIndex index(tokens);
+
+    CHECK(find_token(tokens, 0) == TokenIndex::npos);
+    CHECK(find_token(tokens, 1) == 0);
+    CHECK(find_token(tokens, 3) == 0);
+    CHECK(find_token(tokens, 4) == 0);  // SUM(
+    CHECK_THAT(tokens[find_token(tokens, 6)].value(formula), Equals("A1"));
+    CHECK(find_token(tokens, 8) == TokenIndex::npos);  // whitespace
+    CHECK_THAT(tokens[find_token(tokens, 16)].value(formula), Equals("B1:B2"));
+    CHECK(tokens[find_token(tokens, 19)].type() == Token::Type::Function);
+    CHECK(tokens[find_token(tokens, 19)].subtype() == Token::Subtype::Stop);
+    CHECK(tokens[find_token(tokens, 23)].type() == Token::Type::Array);
+    CHECK(tokens[find_token(tokens, 27)].type() == Token::Type::ArrayRow);
+    CHECK(find_token(tokens, 100) == TokenIndex::npos);
+
+    // enclosing function calls
+    const size_t sum = 0;
+    const size_t max = find_token(tokens, 9);
+    CHECK_THAT(tokens[max].value(formula), Equals("MAX"));
+
+    CHECK(index.enclosing_function(tokens, 0) == TokenIndex::npos);
+    CHECK(index.enclosing_function(tokens, 2) == sum);
+    CHECK(index.enclosing_function(tokens, 5) == sum);
+    CHECK(index.enclosing_function(tokens, 8) == sum);
+    CHECK(index.enclosing_function(tokens, 9) == max);
+    CHECK(index.enclosing_function(tokens, 14) == max);
+    CHECK(index.enclosing_function(tokens, 18) == max);
+    CHECK(index.enclosing_function(tokens, 19) == sum);
+    CHECK(index.enclosing_function(tokens, 21) == TokenIndex::npos);
+    CHECK(index.enclosing_function(tokens, 25) == TokenIndex::npos);
+}
+
+
+TEST_CASE("Structured references are parsed correctly", "[xlfparser]")
+{
+    std::string formula("=SUM(Table1[[#This Row],[Amount]]) + Table1[@[Unit Price]] * Table1['#Items]");
+    auto result = tokenize(formula);
+
+    REQUIRE(result.size() == 7);
+
+    CHECK_THAT(result[1].value(formula), Equals("Table1[[#This Row],[Amount]]"));
+    CHECK(result[1].type() == Token::Type::Operand);
+    CHECK(result[1].subtype() == Token::Subtype::Range);
+    CHECK_THAT(result[4].value(formula), Equals("Table1[@[Unit Price]]"));
+    CHECK_THAT(result[6].value(formula), Equals("Table1['#Items]"));
+
+    StructuredReference<char> ref;
+    REQUIRE(parse_structured_reference(result[1], formula.c_str(), formula.size(), ref));
+    CHECK(ref.table == "Table1");
+    CHECK(ref.items == StructuredReference<char>::ThisRow);
+    CHECK(ref.first_column == "Amount");
+    CHECK(ref.last_column == "Amount");
+
+    REQUIRE(parse_structured_reference(result[4], formula.c_str(), formula.size(), ref));
+    CHECK(ref.items == StructuredReference<char>::ThisRow);
+    CHECK(ref.first_column == "Unit Price");
+
+    REQUIRE(parse_structured_reference(result[6], formula.c_str(), formula.size(), ref));
+    CHECK(ref.items == 0);
+    CHECK(ref.first_column == "'#Items");
+
+    // item specifiers and column ranges
+    formula = "=Table1[[#Headers],[#data],[Price]:[Amount]]+[@Qty]+Table1[#Totals]";
+    result = tokenize(formula);
+    REQUIRE(result.size() == 5);
+
+    REQUIRE(parse_structured_reference(result[0], formula.c_str(), formula.size(), ref));
+    CHECK(ref.items == (StructuredReference<char>::Headers | StructuredReference<char>::Data));
+    CHECK(ref.first_column == "Price");
+    CHECK(ref.last_column == "Amount");
+
+    REQUIRE(parse_structured_reference(result[2], formula.c_str(), formula.size(), ref));
+    CHECK(ref.table.empty());
+    CHECK(ref.items == StructuredReference<char>::ThisRow);
+    CHECK(ref.first_column == "Qty");
+
+    REQUIRE(parse_structured_reference(result[4], formula.c_str(), formula.size(), ref));
+    CHECK(ref.items == StructuredReference<char>::Totals);
+    CHECK(ref.first_column.empty());
+
+    // other bracketed references are not structured references
+    formula = "=R[1]C[-1]+RC[2]+[Book1.xlsx]Sheet1!A1+A1";
+    result = tokenize(formula);
+    REQUIRE(result.size() == 7);
+    for (const auto& token : result)
+        CHECK_FALSE(parse_structured_reference(token, formula.c_str(), formula.size(), ref));
+
+    // the right bracket option is used for the end of bracketed references
+    formula = "=Table1<Amount>*2";
+    result = tokenize(formula, {.left_bracket = '<', .right_bracket = '>'});
+    REQUIRE(result.size() == 3);
+    CHECK_THAT(result[0].value(formula), Equals("Table1<Amount>"));
+}
+
+
+TEST_CASE("Operand subtypes are inferred correctly", "[xlfparser]")
+{
+    std::string formula("=IF(TRUE,TaxRate*A1#,false)+LET(x,Sheet1!B2:C3,x)+R1C1+R2:R3+Table1[Col]+Sheet1!Total+1:1");
+    auto result = tokenize(formula);
+
+    auto subtype_of = [&](const std::string& value) {
+        for (const auto& token : result)
+            if (token.type() == Token::Type::Operand && token.value(formula) == value)
+                return token.subtype();
+        FAIL("Operand " << value << " not found");
+        return Token::Subtype::None;
+    };
+
+    CHECK(subtype_of("TRUE") == Token::Subtype::Logical);
+    CHECK(subtype_of("false") == Token::Subtype::Logical);
+    CHECK(subtype_of("TaxRate") == Token::Subtype::Name);
+    CHECK(subtype_of("A1#") == Token::Subtype::Spill);
+    CHECK(subtype_of("x") == Token::Subtype::Name);
+    CHECK(subtype_of("Sheet1!B2:C3") == Token::Subtype::Range);
+    CHECK(subtype_of("R1C1") == Token::Subtype::Range);
+    CHECK(subtype_of("R2:R3") == Token::Subtype::Range);
+    CHECK(subtype_of("Table1[Col]") == Token::Subtype::Range);
+    CHECK(subtype_of("Sheet1!Total") == Token::Subtype::Name);
+    CHECK(subtype_of("1:1") == Token::Subtype::Range);
+
+    // errors after a sheet name are still errors
+    formula = "=Sheet1!#REF!+SUM(A1#)";
+    result = tokenize(formula);
+    REQUIRE(result.size() == 6);
+    CHECK(result[1].subtype() == Token::Subtype::Error);
+    CHECK_THAT(result[4].value(formula), Equals("A1#"));
+    CHECK(result[4].subtype() == Token::Subtype::Spill);
+
+    // ranges with deleted ends are still ranges
+    for (const char* range : {"=A1:#REF!", "=Sheet1!A1:#REF!"})
+    {
+        formula = range;
+        result = tokenize(formula);
+        REQUIRE(result.size() == 1);
+        CHECK(result[0].subtype() == Token::Subtype::Range);
+    }
+
+    formula = "=#REF!:A1";
+    result = tokenize(formula);
+    REQUIRE(result.size() == 2);
+    CHECK(result[0].subtype() == Token::Subtype::Error);
+    CHECK_THAT(result[1].value(formula), Equals(":A1"));
+    CHECK(result[1].subtype() == Token::Subtype::Range);
+
+    // only references and names can spill, a lone '#' after an error is left as a range
+    formula = "=Sales#+'My Sheet'!R1C1#";
+    result = tokenize(formula);
+    REQUIRE(result.size() == 3);
+    CHECK(result[0].subtype() == Token::Subtype::Spill);
+    CHECK(result[2].subtype() == Token::Subtype::Spill);
+
+    for (const char* error : {"=#N/A#", "=#N/A#+1"})
+    {
+        formula = error;
+        result = tokenize(formula);
+        REQUIRE(result.size() == 2);
+        CHECK(result[0].subtype() == Token::Subtype::Error);
+        CHECK(result[1].subtype() == Token::Subtype::Range);
+    }
+
+    // spill references are normalized in fingerprints
+    CHECK(fingerprint(std::string("=SUM(A1#)"), 1, 2) == fingerprint(std::string("=SUM(A2#)"), 2, 2));
+}
+
+
+TEST_CASE("Batches of formulas are tokenized into one array", "[xlfparser]")
+{
+    std::vector<std::string> formulas = {
+        "=SUM(A1:B2, 1)",
+        "not a formula",
+        "=A1 B1",
+        "=1,5+{1;2}",
+        "=SUM(1))",
+        ""
+    };
+
+    auto batch = tokenize_batch(formulas);
+    REQUIRE(batch.size() == formulas.size());
+    REQUIRE(batch.offsets.size() == formulas.size() + 1);
+    CHECK(batch.offsets.front() == 0);
+    CHECK(batch.offsets.back() == batch.tokens.size());
+
+    CHECK(batch.status[0] == TokenBatch::Status::Ok);
+    CHECK(batch.status[1] == TokenBatch::Status::InvalidFormula);
+    CHECK(batch.status[2] == TokenBatch::Status::Ok);
+    CHECK(batch.status[3] == TokenBatch::Status::Ok);
+    CHECK(batch.status[4] == TokenBatch::Status::InvalidFormula);
+    CHECK(batch.status[5] == TokenBatch::Status::InvalidFormula);
+
+    for (size_t i = 0; i < formulas.size(); ++i)
+    {
+        auto tokens = batch[i];
+        if (batch.status[i] != TokenBatch::Status::Ok)
+        {
+            CHECK(tokens.empty());
+            continue;
+        }
+
+        CHECK(std::vector<Token>(tokens.begin(), tokens.end()) == tokenize(formulas[i]));
+    }
+
+    // A short trailing operand isn't mistaken for part of the previous formula's last token
+    std::vector<std::string> trailing = {"=SUM(A1,B2)", "=A1"};
+    batch = tokenize_batch(trailing);
+    REQUIRE(batch.size() == 2);
+    CHECK(batch[1].size() == 1);
+    CHECK(std::vector<Token>(batch[1].begin(), batch[1].end()) == tokenize(trailing[1]));
+
+    // The options are used for every formula
+    std::vector<std::string_view> views = {"=1,5+{1;2}", "=SUM(1;2)"};
+    Options<char> options;
+    options.decimal_separator = ',';
+    options.list_separator = ';';
+    options.row_separator = '\\';
+
+    batch = tokenize_batch(views.data(), views.size(), options);
+    REQUIRE(batch.size() == 2);
+    CHECK(batch.status[0] == TokenBatch::Status::Ok);
+    CHECK(batch[0][0].subtype() == Token::Subtype::Number);
+    CHECK(std::vector<Token>(batch[1].begin(), batch[1].end()) == tokenize(views[1], options));
+
+    // A formula with a single token following another formula
+    views = {"=A1", "=B2"};
+    batch = tokenize_batch(views.data(), views.size());
+    REQUIRE(batch[1].size() == 1);
+    CHECK(batch[1][0] == tokenize(views[1])[0]);
+}
+
+
+TEST_CASE("Batches of formulas can be tokenized on multiple threads", "[xlfparser]")
+{
+    // A mix of long and short formulas, with some invalid ones, so the work is uneven
+    std::vector<std::string> formulas;
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        std::string formula = "=SUM(A" + std::to_string(i) + ":B2, " + std::to_string(i) + ")";
+        if (i % 97 == 0)
+            for (size_t j = 0; j < 40; ++j)
+                formula += "+IF(A1>1,\"x\",{1,2;3,4})";
+        if (i % 13 == 0)
+            formula += ")";
+        formulas.push_back(formula);
+    }
+
+    const auto expected = tokenize_batch(formulas);
+
+    for (size_t threads : {1, 2, 4, 7})
+    {
+        ThreadPool pool(threads);
+        REQUIRE(pool.size() == threads);
+
+        auto batch = tokenize_batch(pool, formulas);
+        CHECK(batch.offsets == expected.offsets);
+        CHECK(batch.status == expected.status);
+        CHECK(batch.tokens == expected.tokens);
+    }
+
+    ThreadPool pool(3);
+    std::vector<std::string> empty;
+    auto batch = tokenize_batch(pool, empty);
+    CHECK(batch.size() == 0);
+    CHECK(batch.offsets.size() == 1);
+
+    // exceptions in a job are passed back to the caller
+    CHECK_THROWS_AS(pool.run([](size_t i) { if (i == 2) throw std::runtime_error("failed"); }), std::runtime_error);
+}
+
+
+TEST_CASE("Formulas can be read from a memory mapped file", "[xlfparser]")
+{
+    const std::string path = "xlfparser_test_corpus.txt";
+    const std::string index_path = "xlfparser_test_corpus.idx";
+
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "=SUM(A1:B2)\r\n=1+2\n\nnot a formula\n=\"last\"";
+    }
+
+    {
+        MappedCorpus corpus(path);
+        CHECK(!corpus.has_index());
+
+        std::vector<std::string_view> formulas(corpus.begin(), corpus.end());
+        REQUIRE(formulas.size() == 5);
+        CHECK(formulas[0] == "=SUM(A1:B2)");
+        CHECK(formulas[1] == "=1+2");
+        CHECK(formulas[2].empty());
+        CHECK(formulas[3] == "not a formula");
+        CHECK(formulas[4] == "=\"last\"");
+
+        // the views point straight into the mapped file
+        CHECK(formulas[0].data() == corpus.data().data());
+
+        auto batch = tokenize_batch(corpus);
+        REQUIRE(batch.size() == 5);
+        CHECK(batch.status[0] == TokenBatch::Status::Ok);
+        CHECK(batch.status[2] == TokenBatch::Status::InvalidFormula);
+        CHECK(std::vector<Token>(batch[1].begin(), batch[1].end()) == tokenize(std::string("=1+2")));
+
+        CHECK(MappedCorpus::write_index(path, index_path) == 5);
+        MappedCorpus indexed(path, index_path);
+        CHECK(indexed.has_index());
+        REQUIRE(indexed.size() == 5);
+        for (size_t i = 0; i < formulas.size(); ++i)
+            CHECK(indexed[i] == formulas[i]);
+        CHECK_THROWS_AS(indexed[5], std::out_of_range);
+    }
+
+    // NUL delimited, with a trailing delimiter
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write("=A1\n+1\0=B2\0", 11);
+    }
+
+    {
+        MappedCorpus corpus(path, '\0');
+        std::vector<std::string_view> formulas(corpus.begin(), corpus.end());
+        REQUIRE(formulas.size() == 2);
+        CHECK(formulas[0] == "=A1\n+1");
+        CHECK(formulas[1] == "=B2");
+
+        CHECK(MappedCorpus::write_index(path, index_path, '\0') == 2);
+        MappedCorpus indexed(path, index_path, '\0');
+        REQUIRE(indexed.size() == 2);
+        CHECK(indexed[1] == "=B2");
+    }
+
+    // empty files have no formulas
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    }
+
+    {
+        MappedCorpus corpus(path);
+        CHECK(corpus.begin() == corpus.end());
+    }
+
+    std::remove(path.c_str());
+    std::remove(index_path.c_str());
+
+    CHECK_THROWS_AS(MappedCorpus(path), std::system_error);
+}
+
+
+TEST_CASE("Formulas can be extracted from worksheet XML", "[xlfparser]")
+{
+    const std::string xml =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n"
+        "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
+        "<cols><col min=\"1\" max=\"2\"/></cols>"
+        "<sheetData>"
+        "<row r=\"1\"><c r=\"A1\"><v>1</v></c><c r=\"B1\"><f>IF(A1&gt;0,\"a&amp;b\",&quot;&#x41;&quot;)</f><v>a</v></c></row>"
+        "<!-- <c r=\"Z9\"><f>1</f></c> -->"
+        "<row r=\"2\"><c r=\"A2\" t=\"str\"><f t=\"shared\" ref=\"A2:A4\" si=\"0\">SUM(B2:C2)</f><v>3</v></c></row>"
+        "<row r=\"3\"><c r=\"A3\"><f t=\"shared\" si=\"0\"/><v>5</v></c><c><f>A3+</f></c></row>"
+        "<row><c r=\"A4\"><f t='shared' si='0'></f><v>7</v></c></row>"
+        "<row r=\"5\"><c r=\"A5\"><f t=\"shared\" si=\"0\"/></c><c r=\"B5\"><f t=\"array\" ref=\"B5:B6\">{1;2}</f></c></row>"
+        "</sheetData>"
+        "</worksheet>";
+
+    struct Found
+    {
+        size_t row, col;
+        std::string formula;
+        std::vector<Token> tokens;
+        TokenBatch::Status status;
+        bool shared;
+        size_t master_row, master_col;
+    };
+
+    std::vector<Found> found;
+    const size_t count = for_each_sheet_formula(xml.data(), xml.size(), [&](const SheetFormula& f) {
+        found.push_back({f.row, f.col, std::string(f.formula), std::vector<Token>(f.tokens.begin(), f.tokens.end()),
+                         f.status, f.shared, f.master_row, f.master_col});
+    });
+
+    Options<char> body;
+    body.leading_equals = false;
+
+    REQUIRE(count == 7);
+    REQUIRE(found.size() == 7);
+
+    CHECK(found[0].row == 1);
+    CHECK(found[0].col == 2);
+    CHECK_THAT(found[0].formula, Equals("IF(A1>0,\"a&b\",\"A\")"));
+    CHECK(found[0].tokens == tokenize(found[0].formula, body));
+    CHECK(!found[0].shared);
+
+    CHECK_THAT(found[1].formula, Equals("SUM(B2:C2)"));
+    CHECK(!found[1].shared);
+
+    // Shared formulas reuse the master's formula and tokens
+    for (size_t i : {2, 4})
+    {
+        CHECK(found[i].shared);
+        CHECK(found[i].col == 1);
+        CHECK(found[i].master_row == 2);
+        CHECK(found[i].master_col == 1);
+        CHECK(found[i].formula == found[1].formula);
+        CHECK(found[i].tokens == found[1].tokens);
+    }
+    CHECK(found[2].row == 3);
+    CHECK(found[4].row == 4);
+
+    // Cells without an r attribute follow on from the previous cell
+    CHECK(found[3].row == 3);
+    CHECK(found[3].col == 2);
+    CHECK(found[3].status == TokenBatch::Status::Ok);
+
+    // A5 is outside the shared formula's range, which has been dropped
+    CHECK(found[5].row == 5);
+    CHECK(found[5].shared);
+    CHECK(found[5].status == TokenBatch::Status::InvalidFormula);
+    CHECK(found[5].tokens.empty());
+
+    CHECK_THAT(found[6].formula, Equals("{1;2}"));
+    CHECK(found[6].tokens == tokenize(found[6].formula, body));
+}
+
+
+TEST_CASE("Invalid character references in worksheet XML are kept as they are", "[xlfparser]")
+{
+    const std::string xml =
+        "<worksheet><sheetData><row r=\"1\">"
+        "<c r=\"A1\"><f>\"&#65;&#x42;&#X43;&#x20AC;&#x1F600;\"</f></c>"
+        "<c r=\"B1\"><f>\"&#xZZ;&#;&#x;&#0;&#x0x41;&#-65;&#x110000;&#xD800;&#99999999999999999999;\"</f></c>"
+        "</row></sheetData></worksheet>";
+
+    std::vector<std::string> found;
+    for_each_sheet_formula(xml.data(), xml.size(), [&](const SheetFormula& f) { found.emplace_back(f.formula); });
+
+    REQUIRE(found.size() == 2);
+    CHECK_THAT(found[0], Equals("\"ABC\xE2\x82\xAC\xF0\x9F\x98\x80\""));
+    CHECK_THAT(found[1], Equals("\"&#xZZ;&#;&#x;&#0;&#x0x41;&#-65;&#x110000;&#xD800;&#99999999999999999999;\""));
+}
+
+
+TEST_CASE("Only cell formulas are extracted from worksheet XML", "[xlfparser]")
+{
+    const std::string xml =
+        "<worksheet xmlns=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\""
+        " xmlns:x14=\"http://schemas.microsoft.com/office/spreadsheetml/2009/9/main\""
+        " xmlns:xm=\"http://schemas.microsoft.com/office/excel/2006/main\">"
+        "<sheetData>"
+        "<row r=\"1\"><c r=\"A1\"><f>B1*2</f></c><c r=\"B1\"/><f>C1</f></row>"
+        "</sheetData>"
+        "<conditionalFormatting sqref=\"A1\"><cfRule type=\"expression\" priority=\"1\"><formula>A1&gt;1</formula></cfRule></conditionalFormatting>"
+        "<extLst><ext uri=\"{CCE6A557-97BC-4b89-ADB6-D9C93CAAB3DF}\"><x14:dataValidations count=\"1\">"
+        "<x14:dataValidation type=\"list\" allowBlank=\"1\"><x14:formula1><xm:f>Lists!$A$1:$A$5</xm:f></x14:formula1>"
+        "<xm:sqref>A1</xm:sqref></x14:dataValidation>"
+        "</x14:dataValidations></ext></extLst>"
+        "</worksheet>";
+
+    std::vector<std::string> found;
+    auto add = [&](const SheetFormula& f) { found.emplace_back(f.formula); };
+
+    CHECK(for_each_sheet_formula(xml.data(), xml.size(), add) == 1);
+    REQUIRE(found.size() == 1);
+    CHECK_THAT(found[0], Equals("B1*2"));
+
+    // Worksheets can also use a prefix for the main namespace
+    const std::string prefixed =
+        "<x:worksheet xmlns:x=\"http://schemas.openxmlformats.org/spreadsheetml/2006/main\">"
+        "<x:sheetData><x:row r=\"1\"><x:c r=\"A1\"><x:f>SUM(B1:B2)</x:f></x:c><x:c r=\"B1\"><f>1</f></x:c></x:row></x:sheetData>"
+        "</x:worksheet>";
+
+    found.clear();
+    CHECK(for_each_sheet_formula(prefixed.data(), prefixed.size(), add) == 1);
+    REQUIRE(found.size() == 1);
+    CHECK_THAT(found[0], Equals("SUM(B1:B2)"));
+}
+
+
+TEST_CASE("Formulas without a leading '=' can be tokenized", "[xlfparser]")
+{
+    Options<char> options;
+    options.leading_equals = false;
+
+    // offsets are relative to the start of the formula body
+    std::string formula("SUM(A1, 2)");
+    auto result = tokenize(formula, options);
+    auto expected = tokenize(std::string("=") + formula);
+    REQUIRE(result.size() == expected.size());
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        CHECK(result[i].start() + 1 == expected[i].start());
+        CHECK(result[i].end() + 1 == expected[i].end());
+        CHECK(result[i].type() == expected[i].type());
+        CHECK(result[i].subtype() == expected[i].subtype());
+    }
+
+    CHECK_THAT(result[0].value(formula), Equals("SUM"));
+
+    // a leading '=' isn't skipped
+    result = tokenize(std::string("=A1"), options);
+    REQUIRE(result.size() == 2);
+    CHECK(result[0].start() == 0);
+    CHECK(result[0].type() == Token::Type::OperatorInfix);
+
+    CHECK_THROWS_AS(tokenize(std::string(""), options), invalid_formula);
+    CHECK_THROWS_AS(tokenize(std::string("A1"), Options<char>()), invalid_formula);
+
+    // stringify only adds the '=' if the output options say so
+    result = tokenize(formula, options);
+    CHECK_THAT(stringify(result, formula, options), Equals("SUM(A1,2)"));
+    CHECK_THAT(stringify(result, formula, Options<char>()), Equals("=SUM(A1,2)"));
+
+    // retokenize and batches use the same offsets
+    std::string edited("SUM(A1, 23)");
+    CHECK(retokenize(result, edited, 9, 0, 1, options) == tokenize(edited, options));
+
+    std::vector<std::string_view> formulas = {"A1+1", "=A1+1"};
+    auto batch = tokenize_batch(formulas, options);
+    CHECK(std::vector<Token>(batch[0].begin(), batch[0].end()) == tokenize(formulas[0], options));
+    CHECK(std::vector<Token>(batch[1].begin(), batch[1].end()) == tokenize(formulas[1], options));
+
+    // the option is part of the cache key
+    TokenCache<char> cache(1024 * 1024);
+    auto with = cache.tokenize(std::string_view("=1"));
+    auto without = cache.tokenize(std::string_view("=1"), options);
+    CHECK(*with == tokenize(std::string("=1")));
+    CHECK(*without == tokenize(std::string("=1"), options));
+    CHECK(cache.stats().misses == 2);
+}
+
+
+TEST_CASE("Tokens can be saved to and loaded from a binary file", "[xlfparser]")
+{
+    const std::string path = "xlfparser_test_tokens.bin";
+
+    std::vector<std::string> formulas = {
+        "=SUM(A1:B2, 1)",
+        "not a formula",
+        "={1,2;3,4}",
+        "=" + std::string(300, 'A') + "+IF(TRUE,\"x\",1.5E+3)"
+    };
+    const auto batch = tokenize_batch(formulas);
+    write_token_file(path, batch, formulas);
+
+    {
+        TokenFile file(path);
+        REQUIRE(file.size() == formulas.size());
+        CHECK(file.token_count() == batch.tokens.size());
+
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            CHECK(file.status(i) == batch.status[i]);
+            CHECK(file.token_count(i) == batch[i].size());
+            CHECK(file.tokens(i) == std::vector<Token>(batch[i].begin(), batch[i].end()));
+            CHECK(file.matches(i, std::string_view(formulas[i])));
+            CHECK(!file.matches(i, std::string_view("=1")));
+        }
+
+        const auto loaded = file.batch();
+        CHECK(loaded.tokens == batch.tokens);
+        CHECK(loaded.offsets == batch.offsets);
+        CHECK(loaded.status == batch.status);
+
+        CHECK_THROWS_AS(file.tokens(formulas.size()), std::out_of_range);
+    }
+
+    // Corrupting the file is detected by the checksum
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(50);
+        file.put('\x7f');
+    }
+
+    CHECK_THROWS_AS(TokenFile(path), invalid_token_file);
+    CHECK_NOTHROW(TokenFile(path, false));
+
+    // Token counts in unverified files are only trusted as far as there's data for them
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        unsigned char bytes[8];
+        file.seekg(32);
+        file.read(reinterpret_cast<char*>(bytes), 8);
+
+        std::streamoff index_offset = 0;
+        for (size_t i = 8; i > 0; --i)
+            index_offset = (index_offset << 8) | bytes[i - 1];
+
+        file.seekp(24);
+        file.write("\xff\xff\xff\xff\xff\xff\xff\x0f", 8);
+        file.seekp(index_offset + 16);
+        file.write("\xff\xff\xff\xff", 4);
+    }
+
+    {
+        TokenFile file(path, false);
+        CHECK(file.token_count(0) == 0xffffffff);
+        CHECK_THROWS_AS(file.tokens(0), invalid_token_file);
+        CHECK_THROWS_AS(file.batch(), invalid_token_file);
+    }
+
+    // Unknown token types and leftover token data are rejected in unverified files. The bytes
+    // are written at an offset into the first formula's index entry or its token data.
+    const auto corrupt = [&](bool index_entry, std::streamoff at, const char* bytes, size_t size) {
+        write_token_file(path, batch, formulas);
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        unsigned char index[8];
+        file.seekg(32);
+        file.read(reinterpret_cast<char*>(index), 8);
+
+        std::streamoff index_offset = 0;
+        for (size_t i = 8; i > 0; --i)
+            index_offset = (index_offset << 8) | index[i - 1];
+
+        file.seekg(index_offset);
+        file.read(reinterpret_cast<char*>(index), 8);
+
+        std::streamoff data_offset = 0;
+        for (size_t i = 8; i > 0; --i)
+            data_offset = (data_offset << 8) | index[i - 1];
+
+        file.seekp((index_entry ? index_offset : data_offset) + at);
+        file.write(bytes, size);
+    };
+
+    corrupt(false, 0, "\xf0", 1);
+    {
+        TokenFile file(path, false);
+        CHECK_THROWS_AS(file.tokens(0), invalid_token_file);
+        CHECK_THROWS_AS(file.batch(), invalid_token_file);
+    }
+
+    corrupt(false, 0, "\x0f", 1);
+    CHECK_THROWS_AS(TokenFile(path, false).tokens(0), invalid_token_file);
+
+    const uint32_t fewer = static_cast<uint32_t>(batch[0].size() - 1);
+    const char count[4] = {char(fewer), char(fewer >> 8), char(fewer >> 16), char(fewer >> 24)};
+    corrupt(true, 16, count, 4);
+    {
+        TokenFile file(path, false);
+        CHECK(file.token_count(0) == batch[0].size() - 1);
+        CHECK_THROWS_AS(file.tokens(0), invalid_token_file);
+        CHECK_THROWS_AS(file.batch(), invalid_token_file);
+    }
+
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "not a token file";
+    }
+
+    CHECK_THROWS_AS(TokenFile(path), invalid_token_file);
+    std::remove(path.c_str());
+}
+
+
+TEST_CASE("Token batches can be exported as Arrow arrays", "[xlfparser]")
+{
+    std::vector<std::string> formulas = {"=SUM(A1,A1)", "invalid", "=A1+1"};
+    const auto batch = tokenize_batch(formulas);
+
+    ArrowSchema schema;
+    ArrowArray array;
+    export_arrow(batch, formulas, &schema, &array);
+
+    CHECK_THAT(schema.format, Equals("+s"));
+    REQUIRE(schema.n_children == 6);
+    CHECK_THAT(schema.children[0]->name, Equals("formula_id"));
+    CHECK_THAT(schema.children[3]->format, Equals("C"));
+    CHECK_THAT(schema.children[5]->name, Equals("value"));
+    CHECK_THAT(schema.children[5]->format, Equals("i"));
+    REQUIRE(schema.children[5]->dictionary != nullptr);
+    CHECK_THAT(schema.children[5]->dictionary->format, Equals("u"));
+
+    REQUIRE(array.length == int64_t(batch.tokens.size()));
+    REQUIRE(array.n_children == 6);
+
+    const auto* formula_id = static_cast<const int64_t*>(array.children[0]->buffers[1]);
+    const auto* start = static_cast<const int64_t*>(array.children[1]->buffers[1]);
+    const auto* type = static_cast<const uint8_t*>(array.children[3]->buffers[1]);
+    const auto* value = static_cast<const int32_t*>(array.children[5]->buffers[1]);
+
+    const ArrowArray* dictionary = array.children[5]->dictionary;
+    REQUIRE(dictionary != nullptr);
+    const auto* offsets = static_cast<const int32_t*>(dictionary->buffers[1]);
+    const auto* data = static_cast<const char*>(dictionary->buffers[2]);
+
+    size_t row = 0;
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        for (const Token& token : batch[i])
+        {
+            CHECK(formula_id[row] == int64_t(i));
+            CHECK(start[row] == int64_t(token.start()));
+            CHECK(type[row] == uint8_t(token.type()));
+
+            const int32_t v = value[row];
+            CHECK(std::string(data + offsets[v], offsets[v + 1] - offsets[v]) == token.value(formulas[i]));
+            ++row;
+        }
+    }
+
+    // A1 appears three times but is only in the dictionary once
+    CHECK(dictionary->length == int64_t(batch.tokens.size()) - 2);
+
+    // Children can be moved out and outlive their parent
+    ArrowArray moved = *array.children[1];
+    array.children[1]->release = nullptr;
+
+    array.release(&array);
+    CHECK(array.release == nullptr);
+    CHECK(static_cast<const int64_t*>(moved.buffers[1])[0] == 1);
+    moved.release(&moved);
+    CHECK(moved.release == nullptr);
+
+    schema.release(&schema);
+    CHECK(schema.release == nullptr);
+}
+
+
+TEST_CASE("Generated formulas are reproducible and can be tokenized", "[xlfparser]")
+{
+    GeneratorOptions generator_options;
+    generator_options.seed = 1234;
+    generator_options.r1c1_weight = 5;
+
+    FormulaGenerator generator(generator_options);
+    CHECK(generator(7) == FormulaGenerator(generator_options)(7));
+    CHECK(generator(7) != generator(8));
+
+    generator_options.seed = 1235;
+    CHECK(generator(7) != FormulaGenerator(generator_options)(7));
+
+    // Formulas round trip through tokenize and stringify with each set of separators
+    Options<char> locale;
+    locale.list_separator = ';';
+    locale.decimal_separator = ',';
+    locale.row_separator = '\\';
+
+    Options<char> no_equals;
+    no_equals.leading_equals = false;
+
+    for (const auto& format : {Options<char>(), locale, no_equals})
+    {
+        generator_options.format = format;
+        FormulaGenerator formula_generator(generator_options);
+
+        std::vector<std::string> formulas;
+        for (uint64_t i = 0; i < 300; ++i)
+            formulas.push_back(formula_generator(i));
+
+        // A few formulas beyond Excel's 8192 character limit
+        generator_options.min_length = 8192;
+        generator_options.max_length = 10000;
+        FormulaGenerator long_generator(generator_options);
+        for (uint64_t i = 0; i < 3; ++i)
+            formulas.push_back(long_generator(i));
+        generator_options.min_length = GeneratorOptions().min_length;
+        generator_options.max_length = GeneratorOptions().max_length;
+
+        auto batch = tokenize_batch(formulas, format);
+        for (size_t i = 0; i < formulas.size(); ++i)
+        {
+            INFO(formulas[i]);
+            REQUIRE(batch.status[i] == TokenBatch::Status::Ok);
+            CHECK(formulas[i].size() >= generator_options.min_length);
+
+            std::vector<Token> tokens(batch[i].begin(), batch[i].end());
+            CHECK(stringify(tokens, formulas[i], format) == formulas[i]);
+
+            for (const auto& token : tokens)
+                CHECK(token.type() != Token::Type::Unknown);
+        }
+
+        CHECK(formulas.back().size() >= 8192);
+    }
+}
+
+
+TEST_CASE("Formulas are not read past their size", "[xlfparser]")
+{
+    // Exact size and not NUL terminated, as with string views into a larger buffer.
+    // Reads past the end are reported when built with -DXLFP_SANITIZE=ON.
+    for (const std::string formula : {"=A1 ", "=A1 B1  ", "=(A1) ", "={1,2} ", "=SUM(A1, 2) ", "=\"a\"  ", "='a'!A1", "=#N/A"})
+    {
+        INFO(formula);
+        std::unique_ptr<char[]> exact(new char[formula.size()]);
+        std::memcpy(exact.get(), formula.data(), formula.size());
+        CHECK(tokenize(std::string_view(exact.get(), formula.size())) == tokenize(formula));
+    }
+}
+
+
+TEST_CASE("Pathological formulas are tokenized in linear time", "[xlfparser]")
+{
+    auto repeat = [](const std::string& str, size_t length) {
+        std::string result;
+        while (result.size() < length)
+            result += str;
+        return result;
+    };
+
+    // Each formula is about this long, far beyond Excel's limit of 8192 characters.
+    // Anything quadratic in the length would take minutes rather than milliseconds.
+    const size_t N = 100000;
+
+    const std::vector<std::pair<const char*, std::string>> formulas = {
+        {"long number", "=" + repeat("1", N)},
+        {"long scientific notation", "=1." + repeat("2", N) + "E+" + repeat("3", N)},
+        {"scientific notation chain", "=" + repeat("1E+", N) + "1"},
+        {"long error", "=#" + repeat("A", N)},
+        {"hashes", "=" + repeat("#", N)},
+        {"nested parentheses", "=" + repeat("(", N) + "1" + repeat(")", N)},
+        {"nested functions", "=" + repeat("SUM(", N) + "1" + repeat(")", N)},
+        {"nested arrays", "=" + repeat("{", N) + "1" + repeat("}", N)},
+        {"unclosed parentheses", "=" + repeat("(", N)},
+        {"long string", "=\"" + repeat("a\"\"", N) + "\""},
+        {"long sheet name", "='" + repeat("a''", N) + "'!A1"},
+        {"nested brackets", "=Table1" + repeat("[", N) + repeat("]", N)},
+        {"whitespace", "=A1" + repeat(" ", N) + "B1"},
+        {"intersections", "=A1" + repeat(" A1", N)},
+        {"long name", "=" + repeat("A", N)},
+        {"long reference", "=$A$" + repeat("1", N) + ":B2"},
+        {"long R1C1 reference", "=R" + repeat("1", N) + "C" + repeat("2", N)},
+        {"prefix operators", "=" + repeat("-", N) + "1"},
+        {"comparisons", "=" + repeat("1<>", N) + "1"},
+        {"arguments", "=SUM(" + repeat("1,", N) + "1)"},
+        {"large array", "={" + repeat("1,2;", N) + "1}"},
+        {"structured reference", "=Table1[[#All]," + repeat("[a],", N) + "[b]]"},
+        {"postfix operators", "=1" + repeat("%", N)},
+        {"spill operators", "=A1" + repeat("#", N)}
+    };
+
+    for (const auto& entry : formulas)
+    {
+        INFO(entry.first);
+        const std::string& formula = entry.second;
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<Token> tokens;
+        try
+        {
+            tokens = tokenize(formula);
+        }
+        catch (const invalid_formula&)
+        {
+            // only the time taken matters
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        // Generous enough for unoptimized builds on slow machines
+        CHECK(elapsed.count() < 2.0);
+
+        // At most two tokens per character, eg. '{' starts an array and its first row
+        CHECK(tokens.size() <= 2 * formula.size());
+    }
+}
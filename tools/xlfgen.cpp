@@ -0,0 +1,239 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Command line tool for generating a reproducible corpus of synthetic formulas,
+// one per line, for benchmarks and tests.
+//
+// Run with --help for usage.
+
+#include "xlfparser_generator.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+
+using namespace xlfparser;
+
+
+static const char* USAGE =
+    "Usage: xlfgen [options]\n"
+    "\n"
+    "Write randomly generated Excel formulas, one per line. The same options always\n"
+    "produce the same formulas.\n"
+    "\n"
+    "Output:\n"
+    "  -n, --count=N            number of formulas (default 1000)\n"
+    "  --first=N                index of the first formula, for generating a corpus in parts (default 0)\n"
+    "  -o, --output=PATH        write to PATH instead of stdout\n"
+    "  --nul                    separate formulas with NUL characters instead of newlines\n"
+    "\n"
+    "Formulas:\n"
+    "  --seed=N                 random seed (default 0)\n"
+    "  --min-length=N           approximate minimum formula length (default 8)\n"
+    "  --max-length=N           approximate maximum formula length (default 256)\n"
+    "  --max-depth=N            maximum nesting of functions and parentheses (default 4)\n"
+    "  --max-string-length=N    maximum length of string literals (default 24)\n"
+    "  --max-array-size=N       maximum rows and columns of array literals (default 4)\n"
+    "  --r1c1                   use R1C1 references instead of A1 references\n"
+    "  --no-equals              formulas don't start with '='\n"
+    "  --list-separator=C       separator between function arguments (,)\n"
+    "  --decimal-separator=C    decimal point (.)\n"
+    "  --row-separator=C        separator between rows in array literals (;)\n"
+    "  --left-brace=C           start of array literals ({)\n"
+    "  --right-brace=C          end of array literals (})\n"
+    "  --left-bracket=C         start of R1C1 relative references ([)\n"
+    "  --right-bracket=C        end of R1C1 relative references (])\n";
+
+
+struct Arguments
+{
+    uint64_t count = 1000;
+    uint64_t first = 0;
+    std::string output;
+    char delimiter = '\n';
+    GeneratorOptions options;
+};
+
+
+static bool parse_arguments(int argc, char** argv, Arguments& args)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        std::string value;
+
+        // Options can be given as --name=value, --name value or -x value
+        const size_t equals = arg.find('=');
+        const bool has_value = arg.size() > 2 && arg[0] == '-' && equals != std::string::npos;
+        if (has_value)
+        {
+            value = arg.substr(equals + 1);
+            arg = arg.substr(0, equals);
+        }
+
+        auto next_value = [&]() {
+            if (has_value)
+                return true;
+            if (i + 1 >= argc)
+            {
+                std::cerr << "xlfgen: missing value for " << arg << std::endl;
+                return false;
+            }
+            value = argv[++i];
+            return true;
+        };
+
+        auto number_option = [&](auto& option) {
+            if (!next_value())
+                return false;
+            option = std::strtoull(value.c_str(), nullptr, 10);
+            return true;
+        };
+
+        auto char_option = [&](std::optional<char>& option) {
+            if (!next_value())
+                return false;
+            if (value.size() != 1)
+            {
+                std::cerr << "xlfgen: " << arg << " must be a single character" << std::endl;
+                return false;
+            }
+            option = value[0];
+            return true;
+        };
+
+        bool ok = true;
+        if (arg == "-h" || arg == "--help")
+        {
+            std::cout << USAGE;
+            std::exit(0);
+        }
+        else if (arg == "-n" || arg == "--count")
+            ok = number_option(args.count);
+        else if (arg == "--first")
+            ok = number_option(args.first);
+        else if (arg == "-o" || arg == "--output")
+        {
+            ok = next_value();
+            args.output = value;
+        }
+        else if (arg == "--nul")
+            args.delimiter = '\0';
+        else if (arg == "--seed")
+            ok = number_option(args.options.seed);
+        else if (arg == "--min-length")
+            ok = number_option(args.options.min_length);
+        else if (arg == "--max-length")
+            ok = number_option(args.options.max_length);
+        else if (arg == "--max-depth")
+            ok = number_option(args.options.max_depth);
+        else if (arg == "--max-string-length")
+            ok = number_option(args.options.max_string_length);
+        else if (arg == "--max-array-size")
+        {
+            ok = number_option(args.options.max_array_rows);
+            args.options.max_array_columns = args.options.max_array_rows;
+        }
+        else if (arg == "--r1c1")
+            std::swap(args.options.a1_weight, args.options.r1c1_weight);
+        else if (arg == "--no-equals")
+            args.options.format.leading_equals = false;
+        else if (arg == "--list-separator")
+            ok = char_option(args.options.format.list_separator);
+        else if (arg == "--decimal-separator")
+            ok = char_option(args.options.format.decimal_separator);
+        else if (arg == "--row-separator")
+            ok = char_option(args.options.format.row_separator);
+        else if (arg == "--left-brace")
+            ok = char_option(args.options.format.left_brace);
+        else if (arg == "--right-brace")
+            ok = char_option(args.options.format.right_brace);
+        else if (arg == "--left-bracket")
+            ok = char_option(args.options.format.left_bracket);
+        else if (arg == "--right-bracket")
+            ok = char_option(args.options.format.right_bracket);
+        else
+        {
+            std::cerr << "xlfgen: unknown option " << arg << std::endl;
+            return false;
+        }
+
+        if (!ok)
+            return false;
+    }
+
+    return true;
+}
+
+
+int main(int argc, char** argv)
+{
+    Arguments args;
+    if (!parse_arguments(argc, argv, args))
+    {
+        std::cerr << USAGE;
+        return 1;
+    }
+
+    std::ofstream output_file;
+    if (!args.output.empty())
+    {
+        output_file.open(args.output, std::ios::binary | std::ios::trunc);
+        if (!output_file)
+        {
+            std::cerr << "xlfgen: unable to open " << args.output << std::endl;
+            return 2;
+        }
+    }
+    std::ostream& out = args.output.empty() ? std::cout : output_file;
+
+    const FormulaGenerator generator(args.options);
+
+    // Formulas are written in blocks to keep the number of writes down
+    std::string buffer;
+    std::string formula;
+    for (uint64_t i = 0; i < args.count && out; ++i)
+    {
+        generator.generate(args.first + i, formula);
+        buffer += formula;
+        buffer.push_back(args.delimiter);
+
+        if (buffer.size() >= (1 << 20))
+        {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+    out.write(buffer.data(), buffer.size());
+    out.flush();
+    if (!out)
+    {
+        std::cerr << "xlfgen: error writing output" << std::endl;
+        return 2;
+    }
+
+    return 0;
+}
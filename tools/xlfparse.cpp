@@ -0,0 +1,484 @@
+/*
+The MIT License
+
+Copyright (c) 2019 PyXLL Ltd. https://www.pyxll.com
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// Command line tool for tokenizing files of formulas in bulk.
+//
+// Run with --help for usage.
+
+#include "xlfparser.h"
+#include "xlfparser_corpus.h"
+#include "xlfparser_parallel.h"
+#include "xlfparser_tokenfile.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace xlfparser;
+
+
+static const char* USAGE =
+    "Usage: xlfparse [options] [file ...]\n"
+    "\n"
+    "Tokenize Excel formulas, one per line, read from files or stdin ('-' or no files).\n"
+    "\n"
+    "Output:\n"
+    "  --format=FORMAT          jsonl (default), binary or stats\n"
+    "  -o, --output=PATH        write to PATH instead of stdout (required for binary)\n"
+    "  --top=N                  number of functions to list in the stats histogram (default 20)\n"
+    "\n"
+    "Input:\n"
+    "  --nul                    formulas are separated by NUL characters instead of newlines\n"
+    "  --no-equals              formulas don't start with '='\n"
+    "\n"
+    "Tokenizing:\n"
+    "  -j, --threads=N          number of threads (default: one per hardware thread)\n"
+    "  --list-separator=C       separator between function arguments (,)\n"
+    "  --decimal-separator=C    decimal point (.)\n"
+    "  --row-separator=C        separator between rows in array literals (;)\n"
+    "  --left-brace=C           start of array literals ({)\n"
+    "  --right-brace=C          end of array literals (})\n"
+    "  --left-bracket=C         start of R1C1 relative references ([)\n"
+    "  --right-bracket=C        end of R1C1 relative references (])\n";
+
+static const char* TYPE_NAMES[] = {
+    "Unknown", "Operand", "Function", "Array", "ArrayRow", "Subexpression", "Argument",
+    "OperatorPrefix", "OperatorInfix", "OperatorPostfix", "Whitespace"
+};
+
+static const char* SUBTYPE_NAMES[] = {
+    "None", "Start", "Stop", "Text", "Number", "Logical", "Error", "Range", "Math",
+    "Concatenation", "Intersection", "Union", "Name", "Spill"
+};
+
+// Number of formulas tokenized at a time, to keep memory use bounded for JSONL and stats
+static const size_t BLOCK_SIZE = 1 << 16;
+
+
+struct Arguments
+{
+    std::string format = "jsonl";
+    std::string output;
+    size_t top = 20;
+    size_t threads = 0;
+    char delimiter = '\n';
+    Options<char> options;
+    std::vector<std::string> files;
+};
+
+
+static bool parse_arguments(int argc, char** argv, Arguments& args)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        std::string value;
+
+        // Options can be given as --name=value, --name value or -x value
+        const size_t equals = arg.find('=');
+        const bool has_value = arg.size() > 2 && arg[0] == '-' && equals != std::string::npos;
+        if (has_value)
+        {
+            value = arg.substr(equals + 1);
+            arg = arg.substr(0, equals);
+        }
+
+        auto next_value = [&]() {
+            if (has_value)
+                return true;
+            if (i + 1 >= argc)
+            {
+                std::cerr << "xlfparse: missing value for " << arg << std::endl;
+                return false;
+            }
+            value = argv[++i];
+            return true;
+        };
+
+        auto char_option = [&](std::optional<char>& option) {
+            if (!next_value())
+                return false;
+            if (value.size() != 1)
+            {
+                std::cerr << "xlfparse: " << arg << " must be a single character" << std::endl;
+                return false;
+            }
+            option = value[0];
+            return true;
+        };
+
+        if (arg == "-h" || arg == "--help")
+        {
+            std::cout << USAGE;
+            std::exit(0);
+        }
+        else if (arg == "--format")
+        {
+            if (!next_value())
+                return false;
+            args.format = value;
+        }
+        else if (arg == "-o" || arg == "--output")
+        {
+            if (!next_value())
+                return false;
+            args.output = value;
+        }
+        else if (arg == "--top")
+        {
+            if (!next_value())
+                return false;
+            args.top = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "-j" || arg == "--threads")
+        {
+            if (!next_value())
+                return false;
+            args.threads = std::strtoull(value.c_str(), nullptr, 10);
+        }
+        else if (arg == "--nul")
+            args.delimiter = '\0';
+        else if (arg == "--no-equals")
+            args.options.leading_equals = false;
+        else if (arg == "--list-separator")
+        {
+            if (!char_option(args.options.list_separator))
+                return false;
+        }
+        else if (arg == "--decimal-separator")
+        {
+            if (!char_option(args.options.decimal_separator))
+                return false;
+        }
+        else if (arg == "--row-separator")
+        {
+            if (!char_option(args.options.row_separator))
+                return false;
+        }
+        else if (arg == "--left-brace")
+        {
+            if (!char_option(args.options.left_brace))
+                return false;
+        }
+        else if (arg == "--right-brace")
+        {
+            if (!char_option(args.options.right_brace))
+                return false;
+        }
+        else if (arg == "--left-bracket")
+        {
+            if (!char_option(args.options.left_bracket))
+                return false;
+        }
+        else if (arg == "--right-bracket")
+        {
+            if (!char_option(args.options.right_bracket))
+                return false;
+        }
+        else if (arg.size() > 1 && arg[0] == '-')
+        {
+            std::cerr << "xlfparse: unknown option " << arg << std::endl;
+            return false;
+        }
+        else if (arg == "-" && std::find(args.files.begin(), args.files.end(), arg) != args.files.end())
+        {
+            // stdin can only be read once
+            std::cerr << "xlfparse: - can only be given once" << std::endl;
+            return false;
+        }
+        else
+            args.files.push_back(arg);
+    }
+
+    if (args.format != "jsonl" && args.format != "binary" && args.format != "stats")
+    {
+        std::cerr << "xlfparse: unknown format " << args.format << std::endl;
+        return false;
+    }
+
+    if (args.format == "binary" && args.output.empty())
+    {
+        std::cerr << "xlfparse: --output is required for binary output" << std::endl;
+        return false;
+    }
+
+    if (args.files.empty())
+        args.files.push_back("-");
+
+    return true;
+}
+
+
+static void append_json_string(std::string& out, std::string_view str)
+{
+    static const char* HEX = "0123456789abcdef";
+
+    out.push_back('"');
+    for (char c : str)
+    {
+        switch (c)
+        {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    out += "\\u00";
+                    out.push_back(HEX[(c >> 4) & 0xf]);
+                    out.push_back(HEX[c & 0xf]);
+                }
+                else
+                {
+                    out.push_back(c);
+                }
+        }
+    }
+    out.push_back('"');
+}
+
+
+static void append_jsonl(std::string& out, std::string_view formula, TokenRange tokens, TokenBatch::Status status)
+{
+    out += "{\"formula\":";
+    append_json_string(out, formula);
+    out += status == TokenBatch::Status::Ok ? ",\"status\":\"ok\",\"tokens\":[" : ",\"status\":\"invalid\",\"tokens\":[";
+
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const Token& token = tokens[i];
+        out += i ? ",{\"value\":" : "{\"value\":";
+        append_json_string(out, formula.substr(token.start(), token.end() + 1 - token.start()));
+        out += ",\"type\":\"";
+        out += TYPE_NAMES[static_cast<size_t>(token.type())];
+        out += "\",\"subtype\":\"";
+        out += SUBTYPE_NAMES[static_cast<size_t>(token.subtype())];
+        out += "\",\"start\":";
+        out += std::to_string(token.start());
+        out += ",\"end\":";
+        out += std::to_string(token.end());
+        out += "}";
+    }
+
+    out += "]}\n";
+}
+
+
+int main(int argc, char** argv)
+{
+    Arguments args;
+    if (!parse_arguments(argc, argv, args))
+    {
+        std::cerr << USAGE;
+        return 1;
+    }
+
+    // Formulas are views into the mapped files, or into the stdin buffer
+    std::vector<std::unique_ptr<MappedCorpus>> corpora;
+    std::string stdin_data;
+    std::vector<std::string_view> formulas;
+
+    try
+    {
+        for (const auto& file : args.files)
+        {
+            if (file == "-")
+            {
+                stdin_data.assign(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>());
+
+                size_t start = 0;
+                while (start < stdin_data.size())
+                {
+                    size_t end = stdin_data.find(args.delimiter, start);
+                    if (end == std::string::npos)
+                        end = stdin_data.size();
+
+                    std::string_view formula(stdin_data.data() + start, end - start);
+                    if (args.delimiter == '\n' && !formula.empty() && formula.back() == '\r')
+                        formula.remove_suffix(1);
+
+                    formulas.push_back(formula);
+                    start = end + 1;
+                }
+            }
+            else
+            {
+                corpora.emplace_back(new MappedCorpus(file, args.delimiter));
+                formulas.insert(formulas.end(), corpora.back()->begin(), corpora.back()->end());
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "xlfparse: " << e.what() << std::endl;
+        return 2;
+    }
+
+    std::ofstream output_file;
+    if (!args.output.empty() && args.format != "binary")
+    {
+        output_file.open(args.output, std::ios::binary | std::ios::trunc);
+        if (!output_file)
+        {
+            std::cerr << "xlfparse: unable to open " << args.output << std::endl;
+            return 2;
+        }
+    }
+    std::ostream& out = args.output.empty() ? std::cout : output_file;
+
+    ThreadPool pool(args.threads);
+
+    TokenBatch all;  // only used for binary output
+    size_t invalid = 0;
+    size_t num_tokens = 0;
+    size_t num_chars = 0;
+    std::unordered_map<std::string, size_t> functions;
+    std::chrono::duration<double> elapsed(0);
+    std::string buffer;
+
+    for (size_t first = 0; first < formulas.size(); first += BLOCK_SIZE)
+    {
+        const size_t count = std::min(BLOCK_SIZE, formulas.size() - first);
+
+        const auto start = std::chrono::steady_clock::now();
+        TokenBatch batch = tokenize_batch(pool, formulas.data() + first, count, args.options);
+        elapsed += std::chrono::steady_clock::now() - start;
+
+        num_tokens += batch.tokens.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            num_chars += formulas[first + i].size();
+            if (batch.status[i] != TokenBatch::Status::Ok)
+                ++invalid;
+        }
+
+        if (args.format == "jsonl")
+        {
+            buffer.clear();
+            for (size_t i = 0; i < count; ++i)
+                append_jsonl(buffer, formulas[first + i], batch[i], batch.status[i]);
+            out.write(buffer.data(), buffer.size());
+        }
+        else if (args.format == "stats")
+        {
+            for (size_t i = 0; i < count; ++i)
+            {
+                for (const Token& token : batch[i])
+                {
+                    if (token.type() != Token::Type::Function || token.subtype() != Token::Subtype::Start)
+                        continue;
+
+                    std::string name(formulas[first + i].substr(token.start(), token.end() + 1 - token.start()));
+                    std::transform(name.begin(), name.end(), name.begin(), [](char c) { return _to_upper(c); });
+                    ++functions[name];
+                }
+            }
+        }
+        else
+        {
+            const size_t base = all.tokens.size();
+            all.tokens.insert(all.tokens.end(), batch.tokens.begin(), batch.tokens.end());
+            for (size_t i = 1; i < batch.offsets.size(); ++i)
+                all.offsets.push_back(base + batch.offsets[i]);
+            all.status.insert(all.status.end(), batch.status.begin(), batch.status.end());
+        }
+    }
+
+    if (args.format == "binary")
+    {
+        try
+        {
+            write_token_file(args.output, all, formulas.data());
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "xlfparse: " << e.what() << std::endl;
+            return 2;
+        }
+    }
+    else if (args.format == "stats")
+    {
+        const double seconds = elapsed.count();
+        out << "formulas:        " << formulas.size() << "\n"
+            << "invalid:         " << invalid << "\n"
+            << "tokens:          " << num_tokens << "\n"
+            << "characters:      " << num_chars << "\n"
+            << "threads:         " << pool.size() << "\n"
+            << "seconds:         " << seconds << "\n";
+
+        if (seconds > 0)
+            out << "formulas/sec:    " << size_t(formulas.size() / seconds) << "\n"
+                << "tokens/sec:      " << size_t(num_tokens / seconds) << "\n"
+                << "MB/sec:          " << num_chars / seconds / 1e6 << "\n";
+
+        std::vector<std::pair<std::string, size_t>> histogram(functions.begin(), functions.end());
+        std::sort(histogram.begin(), histogram.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
+        });
+
+        if (histogram.size() > args.top)
+            histogram.resize(args.top);
+
+        out << "functions:\n";
+        for (const auto& entry : histogram)
+            out << "  " << entry.first << "\t" << entry.second << "\n";
+
+#ifdef XLFP_STATS
+        const TokenizeStats stats = tokenize_stats();
+        out << "tokenizer:\n"
+            << "  chars_default\t" << stats.chars_default << "\n"
+            << "  chars_in_string\t" << stats.chars_in_string << "\n"
+            << "  chars_in_path\t" << stats.chars_in_path << "\n"
+            << "  chars_in_range\t" << stats.chars_in_range << "\n"
+            << "  chars_in_error\t" << stats.chars_in_error << "\n"
+            << "  scientific_notation_checks\t" << stats.scientific_notation_checks << "\n"
+            << "  intersections\t" << stats.intersections << "\n"
+            << "  max_depth\t" << stats.max_depth << "\n";
+
+        for (size_t i = 0; i < sizeof(TYPE_NAMES) / sizeof(TYPE_NAMES[0]); ++i)
+            out << "  tokens." << TYPE_NAMES[i] << "\t" << stats.tokens[i] << "\n";
+#endif
+    }
+
+    out.flush();
+    if (!out)
+    {
+        std::cerr << "xlfparse: error writing output" << std::endl;
+        return 2;
+    }
+
+    return 0;
+}